@@ -46,6 +46,8 @@ class AutoVar : public Var {
 
   virtual bool IsFunc(Evaluator*) const override { return true; }
 
+  virtual bool IsVolatile() const override { return true; }
+
  protected:
   AutoVar(CommandEvaluator* ce, const char* sym) : ce_(ce), sym_(sym) {}
   virtual ~AutoVar() = default;
@@ -29,6 +29,7 @@
 #include "fileutil.h"
 #include "parser.h"
 #include "rule.h"
+#include "shell_speculator.h"
 #include "stats.h"
 #include "stmt.h"
 #include "strutil.h"
@@ -281,6 +282,7 @@ Var* Evaluator::EvalRHS(Symbol lhs,
       } else {
         result = prev;
         result->AppendVar(this, rhs_v);
+        lhs.BumpGlobalVarVersion();
         *needs_assign = false;
       }
       break;
@@ -615,9 +617,12 @@ void Evaluator::DoInclude(const string& fname) {
     Error(StringPrintf("%s does not exist", fname.c_str()));
   }
 
-  Var* var_list = LookupVar(Intern("MAKEFILE_LIST"));
+  Symbol makefile_list = Intern("MAKEFILE_LIST");
+  Var* var_list = LookupVar(makefile_list);
   var_list->AppendVar(
       this, Value::NewLiteral(Intern(TrimLeadingCurdir(fname)).str()));
+  makefile_list.BumpGlobalVarVersion();
+  SpeculateShellCommands(mk.stmts(), this);
   for (Stmt* stmt : mk.stmts()) {
     LOG("%s", stmt->DebugString().c_str());
     stmt->Eval(this);
@@ -768,9 +773,46 @@ Var* Evaluator::LookupVar(Symbol name) {
   }
 
   TraceVariableLookup("lookup", name, result);
+  if (!var_reads_.empty())
+    RecordVarRead(name, result);
   return result;
 }
 
+bool Evaluator::CanMemoizeVars() const {
+  return g_flags.memoize_recursive_vars && !current_scope_ &&
+         !assignment_tracefile_;
+}
+
+void Evaluator::RecordVarRead(Symbol name, Var* var) {
+  VarReads* reads = var_reads_.back();
+  // Deprecated and obsolete variables warn on every use.
+  if (current_scope_ || var->IsVolatile() || var->Deprecated() ||
+      var->Obsolete()) {
+    reads->memoizable = false;
+    return;
+  }
+  reads->versions.emplace_back(name, name.GlobalVarVersion());
+}
+
+void Evaluator::EndVarReads() {
+  VarReads* reads = var_reads_.back();
+  var_reads_.pop_back();
+  if (!var_reads_.empty())
+    AddVarReads(*reads);
+}
+
+void Evaluator::AddVarReads(const VarReads& reads) {
+  if (var_reads_.empty())
+    return;
+  VarReads* outer = var_reads_.back();
+  if (!reads.memoizable) {
+    outer->memoizable = false;
+    return;
+  }
+  outer->versions.insert(outer->versions.end(), reads.versions.begin(),
+                         reads.versions.end());
+}
+
 Var* Evaluator::PeekVar(Symbol name) {
   Var* result = nullptr;
 
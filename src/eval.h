@@ -131,6 +131,20 @@ class IncludeGraph {
   std::vector<const Frame*> include_stack_;
 };
 
+// The global variables an expansion read, and their versions at the
+// time. The expansion can be reused while none of them changes.
+struct VarReads {
+  VarReads() : memoizable(true) {}
+
+  vector<pair<Symbol, int>> versions;
+  // Versions after this one were bound during the expansion, by foreach
+  // and call, and are gone once it finishes.
+  int start_version;
+  // Cleared when the expansion reads a variable whose value is not fixed
+  // by its version, or calls a function with side effects.
+  bool memoizable;
+};
+
 class Evaluator {
   friend ScopedFrame;
 
@@ -157,6 +171,23 @@ class Evaluator {
   // Equivalent to LookupVar, but doesn't mark as used.
   Var* PeekVar(Symbol name);
 
+  // With --memoize_recursive_vars, recursive variables record what their
+  // expansion reads, and reuse it while that stays the same. Only
+  // expansions outside of rule scopes are memoized.
+  bool CanMemoizeVars() const;
+  void BeginVarReads(VarReads* reads) {
+    reads->start_version = GetLastGlobalVarVersion();
+    var_reads_.push_back(reads);
+  }
+  // Adds the reads of the innermost expansion to the enclosing one.
+  void EndVarReads();
+  // Adds the reads of a reused expansion to the enclosing one.
+  void AddVarReads(const VarReads& reads);
+  void MarkNotMemoizable() {
+    if (!var_reads_.empty())
+      var_reads_.back()->memoizable = false;
+  }
+
   string EvalVar(Symbol name);
 
   const Loc& loc() const { return loc_; }
@@ -239,6 +270,7 @@ class Evaluator {
   void DoInclude(const string& fname);
 
   void TraceVariableLookup(const char* operation, Symbol name, Var* var);
+  void RecordVarRead(Symbol name, Var* var);
   Var* LookupVarGlobal(Symbol name);
 
   // Equivalent to LookupVarInCurrentScope, but doesn't mark as used.
@@ -258,6 +290,8 @@ class Evaluator {
 
   Rule* last_rule_;
   Vars* current_scope_;
+  // The reads of the recursive variables being expanded, innermost last.
+  vector<VarReads*> var_reads_;
 
   Loc loc_;
   bool is_bootstrap_;
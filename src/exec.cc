@@ -16,11 +16,20 @@
 
 #include "exec.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include <atomic>
+#include <deque>
+#include <future>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -31,8 +40,11 @@
 #include "expr.h"
 #include "fileutil.h"
 #include "flags.h"
+#include "jobserver.h"
 #include "log.h"
+#include "process.h"
 #include "string_piece.h"
+#include "stringprintf.h"
 #include "strutil.h"
 #include "symtab.h"
 #include "var.h"
@@ -42,11 +54,153 @@ namespace {
 const double kNotExist = -2.0;
 const double kProcessing = -1.0;
 
+// Timestamps of files seen during one run of the executor. Each file is
+// statted once; only outputs rebuilt by the executor are statted again.
+class StatCache {
+ public:
+  ~StatCache() { CancelPrefetch(); }
+
+  double Get(Symbol f) {
+    {
+      unique_lock<mutex> lock(mu_);
+      auto found = ts_.find(f);
+      if (found != ts_.end())
+        return found->second;
+    }
+    double ts = GetTimestamp(f.str());
+    unique_lock<mutex> lock(mu_);
+    return ts_.emplace(f, ts).first->second;
+  }
+
+  bool Exists(Symbol f) { return Get(f) != kNotExist; }
+
+  void Invalidate(Symbol f) {
+    unique_lock<mutex> lock(mu_);
+    ts_.erase(f);
+  }
+
+  // Stats the source files reachable from |roots| on a worker thread,
+  // one directory at a time, while the executor walks the graph.
+  void Prefetch(const vector<NamedDepNode>& roots) {
+    map<StringPiece, vector<Symbol>> files_by_dir;
+    SymbolSet seen;
+    vector<DepNode*> stack;
+    for (auto const& root : roots)
+      stack.push_back(root.second);
+    while (!stack.empty()) {
+      DepNode* n = stack.back();
+      stack.pop_back();
+      if (seen.exists(n->output))
+        continue;
+      seen.insert(n->output);
+      // Only files without rules, as nothing in this build writes them.
+      if (!n->has_rule && !n->is_phony)
+        files_by_dir[Dirname(n->output.str())].push_back(n->output);
+      for (auto const& d : n->deps)
+        stack.push_back(d.second);
+      for (auto const& d : n->order_onlys)
+        stack.push_back(d.second);
+    }
+    if (files_by_dir.empty())
+      return;
+
+    prefetch_ = std::async(std::launch::async, [this, files_by_dir]() {
+      for (auto const& p : files_by_dir) {
+        if (cancelled_)
+          return;
+        PrefetchDir(p.first, p.second);
+      }
+    });
+  }
+
+  // Stops the prefetch after the directory being statted, and waits for
+  // it, e.g. before exiting.
+  void CancelPrefetch() {
+    cancelled_ = true;
+    if (prefetch_.valid())
+      prefetch_.wait();
+  }
+
+ private:
+  void PrefetchDir(StringPiece dir, const vector<Symbol>& files) {
+    // Resolve the directory once and look up every file relative to it.
+    int dirfd = -1;
+    if (!dir.empty()) {
+      dirfd =
+          open(dir.as_string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    vector<pair<Symbol, double>> results;
+    for (Symbol f : files) {
+      struct stat st;
+      int r;
+      if (dirfd >= 0) {
+        r = fstatat(dirfd, Basename(f.str()).as_string().c_str(), &st, 0);
+      } else {
+        r = stat(f.c_str(), &st);
+      }
+      // Missing files are left to Get, as an earlier recipe may create
+      // them by the time the executor looks.
+      if (r == 0)
+        results.emplace_back(f, GetTimestampFromStat(st));
+    }
+    if (dirfd >= 0)
+      close(dirfd);
+
+    unique_lock<mutex> lock(mu_);
+    for (auto const& p : results)
+      ts_.emplace(p.first, p.second);
+  }
+
+  mutex mu_;
+  unordered_map<Symbol, double> ts_;
+  atomic<bool> cancelled_{false};
+  future<void> prefetch_;
+};
+
+// A node whose deps have been visited and which may need to run its
+// commands. Jobs become ready when all jobs of their deps have finished.
+struct Job {
+  explicit Job(DepNode* n)
+      : node(n),
+        needs_commands(false),
+        has_token(false),
+        num_pending_deps(0),
+        next_command(0) {}
+
+  DepNode* node;
+  // False if this job only waits for its deps, e.g. when the output is
+  // up to date but some deps are still being built.
+  bool needs_commands;
+  // Whether this job runs on a token taken from the jobserver.
+  bool has_token;
+  int num_pending_deps;
+  vector<Job*> dependents;
+  vector<Command*> commands;
+  size_t next_command;
+  // Echoed commands not printed yet, printed together with the output of
+  // the running command so concurrent commands do not interleave.
+  string output;
+};
+
 class Executor {
  public:
-  explicit Executor(Evaluator* ev) : ce_(ev), num_commands_(0) {
+  explicit Executor(Evaluator* ev)
+      : ce_(ev),
+        num_commands_(0),
+        num_jobs_(1),
+        num_tokens_(0),
+        failed_(false),
+        user_time_(0),
+        sys_time_(0) {
     shell_ = ev->GetShell();
     shellflag_ = ev->GetShellFlag();
+    jobserver_.reset(Jobserver::Create());
+    if (g_flags.has_num_jobs) {
+      num_jobs_ = g_flags.num_jobs;
+    } else if (jobserver_) {
+      // The parent make decides how many jobs we may run.
+      num_jobs_ = numeric_limits<size_t>::max();
+    }
   }
 
   double ExecNode(DepNode* n, DepNode* needed_by) {
@@ -59,93 +213,275 @@ class Executor {
       }
       return found->second;
     }
+
+    done_[n->output] = kProcessing;
+    double output_ts;
+    Job* job = VisitNode(n, needed_by, &output_ts);
+    done_[n->output] = output_ts;
+    if (job) {
+      jobs_[n->output] = job;
+      if (job->num_pending_deps == 0)
+        ready_.push_back(job);
+      // With -j1, this runs |job| to completion before visiting the next
+      // node, just like a plain serial build.
+      RunJobs(num_jobs_);
+    }
+    return output_ts;
+  }
+
+  void WaitAll() { RunJobs(1); }
+
+  void PrefetchTimestamps(const vector<NamedDepNode>& roots) {
+    stat_cache_.Prefetch(roots);
+  }
+
+  uint64_t Count() { return num_commands_; }
+
+  double user_time() const { return user_time_; }
+  double sys_time() const { return sys_time_; }
+
+ private:
+  // Visits the deps of |n| and returns a job for |n| unless it is up to
+  // date and none of its deps are still being built.
+  Job* VisitNode(DepNode* n, DepNode* needed_by, double* output_ts) {
     ScopedFrame frame(
         ce_.evaluator()->Enter(FrameType::EXEC, n->output.c_str(), n->loc));
 
-    done_[n->output] = kProcessing;
-    double output_ts = GetTimestamp(n->output.c_str());
+    *output_ts = stat_cache_.Get(n->output);
 
     LOG("ExecNode: %s for %s", n->output.c_str(),
         needed_by ? needed_by->output.c_str() : "(null)");
 
-    if (!n->has_rule && output_ts == kNotExist && !n->is_phony) {
+    if (!n->has_rule && *output_ts == kNotExist && !n->is_phony) {
       if (needed_by) {
-        ERROR("*** No rule to make target '%s', needed by '%s'.",
-              n->output.c_str(), needed_by->output.c_str());
+        Fail(StringPrintf("*** No rule to make target '%s', needed by '%s'.",
+                          n->output.c_str(), needed_by->output.c_str()));
       } else {
-        ERROR("*** No rule to make target '%s'.", n->output.c_str());
+        Fail(StringPrintf("*** No rule to make target '%s'.",
+                          n->output.c_str()));
       }
     }
 
+    vector<DepNode*> visited_deps;
     double latest = kProcessing;
     for (auto const& d : n->order_onlys) {
-      if (Exists(d.second->output.str())) {
+      if (stat_cache_.Exists(d.second->output)) {
         continue;
       }
       double ts = ExecNode(d.second, n);
       if (latest < ts)
         latest = ts;
+      visited_deps.push_back(d.second);
     }
 
     for (auto const& d : n->deps) {
       double ts = ExecNode(d.second, n);
       if (latest < ts)
         latest = ts;
+      visited_deps.push_back(d.second);
     }
 
-    if (output_ts >= latest && !n->is_phony) {
-      done_[n->output] = output_ts;
-      return output_ts;
+    Job* job = new Job(n);
+    job->needs_commands = *output_ts < latest || n->is_phony;
+    for (DepNode* d : visited_deps) {
+      auto found = jobs_.find(d->output);
+      if (found == jobs_.end())
+        continue;
+      Job* dep_job = found->second;
+      // A dep may appear more than once.
+      if (!dep_job->dependents.empty() && dep_job->dependents.back() == job)
+        continue;
+      dep_job->dependents.push_back(job);
+      job->num_pending_deps++;
     }
 
-    vector<Command*> commands;
-    ce_.Eval(n, &commands);
-    for (Command* command : commands) {
+    if (!job->needs_commands && job->num_pending_deps == 0) {
+      delete job;
+      return NULL;
+    }
+    return job;
+  }
+
+  // Starts ready jobs and waits until fewer than |limit| jobs are running.
+  void RunJobs(size_t limit) {
+    while (true) {
+      while (!ready_.empty() && running_.size() < num_jobs_) {
+        Job* job = ready_.front();
+        if (job->needs_commands && !AcquireToken(job))
+          break;
+        ready_.pop_front();
+        StartJob(job);
+      }
+      if (running_.size() < limit && (limit > 1 || ready_.empty()))
+        return;
+      WaitForCommand();
+    }
+  }
+
+  // We run one job for free. Every other concurrent job needs a token when
+  // there is a jobserver.
+  bool AcquireToken(Job* job) {
+    // Nothing new starts after a failure.
+    if (failed_)
+      return false;
+    if (!jobserver_ || running_.size() < num_tokens_ + 1)
+      return true;
+    if (!jobserver_->TryAcquire())
+      return false;
+    job->has_token = true;
+    num_tokens_++;
+    return true;
+  }
+
+  void StartJob(Job* job) {
+    if (job->needs_commands) {
+      DepNode* n = job->node;
+      ScopedFrame frame(
+          ce_.evaluator()->Enter(FrameType::EXEC, n->output.c_str(), n->loc));
+      ce_.Eval(n, &job->commands);
+    }
+    StartNextCommand(job);
+  }
+
+  // Runs the next command of |job|. After a failure, the rest of the
+  // commands are neither echoed nor run.
+  void StartNextCommand(Job* job) {
+    while (job->next_command < job->commands.size() && !failed_) {
+      Command* command = job->commands[job->next_command];
       num_commands_ += 1;
       if (command->echo) {
-        printf("%s\n", command->cmd.c_str());
-        fflush(stdout);
+        if (num_jobs_ == 1) {
+          printf("%s\n", command->cmd.c_str());
+          fflush(stdout);
+        } else {
+          job->output += command->cmd;
+          job->output += '\n';
+        }
       }
       if (!g_flags.is_dry_run) {
-        string out;
-        int result = RunCommand(shell_, shellflag_, command->cmd.c_str(),
-                                RedirectStderr::STDOUT, &out);
-        printf("%s", out.c_str());
-        if (result != 0) {
-          if (command->ignore_error) {
-            fprintf(stderr, "[%s] Error %d (ignored)\n",
-                    command->output.c_str(), WEXITSTATUS(result));
-          } else {
-            fprintf(stderr, "*** [%s] Error %d\n", command->output.c_str(),
-                    WEXITSTATUS(result));
-            exit(1);
-          }
-        }
+        Subprocess* p = runner_.Start(shell_, shellflag_, command->cmd,
+                                      RedirectStderr::STDOUT);
+        running_[p] = job;
+        return;
       }
+      FlushOutput(job);
+      job->next_command++;
+    }
+    FinishJob(job);
+  }
+
+  void WaitForCommand() {
+    // Also wake up when a token may be available for a ready job. After a
+    // failure, only the exits of the running commands matter.
+    int watch_fd = -1;
+    if (jobserver_ && !ready_.empty() && !failed_)
+      watch_fd = jobserver_->fd();
+    unique_ptr<Subprocess> p(runner_.Wait(watch_fd));
+    if (!p)
+      return;
+    auto found = running_.find(p.get());
+    CHECK(found != running_.end());
+    Job* job = found->second;
+    running_.erase(found);
+    FinishCommand(job, p.get());
+  }
+
+  void FinishCommand(Job* job, Subprocess* p) {
+    user_time_ += TimevalToSeconds(p->rusage.ru_utime);
+    sys_time_ += TimevalToSeconds(p->rusage.ru_stime);
+    job->output += p->output;
+    FlushOutput(job);
+
+    int status = p->status;
+    Command* command = job->commands[job->next_command++];
+    if (status != 0) {
+      if (command->ignore_error) {
+        fprintf(stderr, "[%s] Error %d (ignored)\n", command->output.c_str(),
+                WEXITSTATUS(status));
+      } else {
+        Fail(StringPrintf("*** [%s] Error %d", command->output.c_str(),
+                          WEXITSTATUS(status)));
+      }
+    }
+    StartNextCommand(job);
+  }
+
+  static double TimevalToSeconds(const struct timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+  }
+
+  void FinishJob(Job* job) {
+    for (Command* command : job->commands)
       delete command;
+    jobs_.erase(job->node->output);
+    if (job->needs_commands)
+      stat_cache_.Invalidate(job->node->output);
+    if (job->has_token) {
+      jobserver_->Release();
+      num_tokens_--;
+    }
+    for (Job* dependent : job->dependents) {
+      if (--dependent->num_pending_deps == 0 && !failed_)
+        ready_.push_back(dependent);
     }
+    delete job;
+  }
 
-    done_[n->output] = output_ts;
-    return output_ts;
+  void FlushOutput(Job* job) {
+    printf("%s", job->output.c_str());
+    fflush(stdout);
+    job->output.clear();
   }
 
-  uint64_t Count() { return num_commands_; }
+  // Reports |msg| and exits once the commands already running finish.
+  // Failures of those commands are reported too.
+  void Fail(const string& msg) {
+    fprintf(stderr, "%s\n", msg.c_str());
+    // The first failure is waiting for the running commands.
+    if (failed_)
+      return;
+    failed_ = true;
+    if (!running_.empty()) {
+      fprintf(stderr, "*** Waiting for unfinished jobs....\n");
+      ready_.clear();
+      while (!running_.empty())
+        WaitForCommand();
+    }
+    stat_cache_.CancelPrefetch();
+    exit(1);
+  }
 
- private:
   CommandEvaluator ce_;
   unordered_map<Symbol, double> done_;
+  StatCache stat_cache_;
+  unordered_map<Symbol, Job*> jobs_;
+  deque<Job*> ready_;
+  ProcessRunner runner_;
+  unordered_map<Subprocess*, Job*> running_;
   string shell_;
   string shellflag_;
   uint64_t num_commands_;
+  size_t num_jobs_;
+  unique_ptr<Jobserver> jobserver_;
+  size_t num_tokens_;
+  bool failed_;
+  // CPU time used by the commands run so far.
+  double user_time_;
+  double sys_time_;
 };
 
 }  // namespace
 
 void Exec(const vector<NamedDepNode>& roots, Evaluator* ev) {
+  DisableGlobWithFindEmulator();
   unique_ptr<Executor> executor(new Executor(ev));
+  executor->PrefetchTimestamps(roots);
   for (auto const& root : roots) {
     executor->ExecNode(root.second, NULL);
   }
+  executor->WaitAll();
+  LOG_STAT("commands: %.3f user %.3f sys", executor->user_time(),
+           executor->sys_time());
   if (executor->Count() == 0) {
     for (auto const& root : roots) {
       printf("kati: Nothing to be done for `%s'.\n", root.first.c_str());
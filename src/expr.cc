@@ -16,6 +16,8 @@
 
 #include "expr.h"
 
+#include <string.h>
+
 #include <vector>
 
 #include "eval.h"
@@ -35,6 +37,18 @@ string Evaluable::Eval(Evaluator* ev) const {
   return s;
 }
 
+shared_ptr<string> Evaluable::EvalShared(Evaluator* ev) const {
+  shared_ptr<string> s = make_shared<string>();
+  Eval(ev, s.get());
+  return s;
+}
+
+void Evaluable::EvalRope(Evaluator* ev, Rope* r) const {
+  shared_ptr<string> s = make_shared<string>();
+  Eval(ev, s.get());
+  r->Append(s);
+}
+
 Value::Value(const Loc& loc) : Evaluable(loc) {}
 
 Value::~Value() {}
@@ -56,9 +70,21 @@ class Literal : public Value {
     s->append(s_.begin(), s_.end());
   }
 
+  virtual void EvalRope(Evaluator* ev, Rope* r) const override {
+    ev->CheckStack();
+    r->Append(s_);
+  }
+
   virtual bool IsLiteral() const override { return true; }
   virtual StringPiece GetLiteralValueUnsafe() const override { return s_; }
 
+  virtual bool GetSpeculativeShellCommands(
+      Evaluator*,
+      const SymbolSet&,
+      vector<StringPiece>*) const override {
+    return true;
+  }
+
   virtual string DebugString_() const override { return s_.as_string(); }
 
  private:
@@ -109,6 +135,24 @@ class ValueList : public Value {
     }
   }
 
+  virtual void EvalRope(Evaluator* ev, Rope* r) const override {
+    ev->CheckStack();
+    for (Value* v : vals_) {
+      v->EvalRope(ev, r);
+    }
+  }
+
+  virtual bool GetSpeculativeShellCommands(
+      Evaluator* ev,
+      const SymbolSet& deferred_vars,
+      vector<StringPiece>* cmds) const override {
+    for (Value* v : vals_) {
+      if (!v->GetSpeculativeShellCommands(ev, deferred_vars, cmds))
+        return false;
+    }
+    return true;
+  }
+
   virtual string DebugString_() const override {
     string r;
     for (Value* v : vals_) {
@@ -149,6 +193,37 @@ class SymRef : public Value {
     ev->VarEvalComplete(name_);
   }
 
+  virtual shared_ptr<string> EvalShared(Evaluator* ev) const override {
+    ev->CheckStack();
+    Var* v = ev->LookupVarForEval(name_);
+    v->Used(ev, name_);
+    shared_ptr<string> s = v->EvalShared(ev);
+    ev->VarEvalComplete(name_);
+    return s;
+  }
+
+  virtual void EvalRope(Evaluator* ev, Rope* r) const override {
+    ev->CheckStack();
+    Var* v = ev->LookupVarForEval(name_);
+    v->Used(ev, name_);
+    v->EvalRope(ev, r);
+    ev->VarEvalComplete(name_);
+  }
+
+  virtual bool GetSpeculativeShellCommands(
+      Evaluator* ev,
+      const SymbolSet& deferred_vars,
+      vector<StringPiece>*) const override {
+    if (deferred_vars.exists(name_))
+      return false;
+    Var* v = ev->PeekVar(name_);
+    if (!v->IsDefined())
+      return true;
+    // Deprecated variables warn when used.
+    return !strcmp(v->Flavor(), "simple") && !v->Deprecated() &&
+           !v->Obsolete();
+  }
+
   virtual string DebugString_() const override {
     return StringPrintf("SymRef(%s)", name_.c_str());
   }
@@ -247,11 +322,33 @@ class Func : public Value {
     ScopedFrame frame(ev->Enter(FrameType::FUNCALL, fi_->name, Location()));
     ev->CheckStack();
     LOG("Invoke func %s(%s)", name(), JoinValues(args_, ",").c_str());
+    if (!fi_->pure)
+      ev->MarkNotMemoizable();
     ev->IncrementEvalDepth();
     fi_->func(args_, ev, s);
     ev->DecrementEvalDepth();
   }
 
+  virtual bool GetSpeculativeShellCommands(
+      Evaluator* ev,
+      const SymbolSet& deferred_vars,
+      vector<StringPiece>* cmds) const override {
+    if (!strcmp(fi_->name, "shell")) {
+      if (args_.size() != 1 || !args_[0]->IsLiteral())
+        return false;
+      cmds->push_back(args_[0]->GetLiteralValueUnsafe());
+      return true;
+    }
+    // $(call) expands a variable chosen at run time.
+    if (!fi_->pure || !strcmp(fi_->name, "call"))
+      return false;
+    for (Value* a : args_) {
+      if (!a->GetSpeculativeShellCommands(ev, deferred_vars, cmds))
+        return false;
+    }
+    return true;
+  }
+
   virtual string DebugString_() const override {
     return StringPrintf("Func(%s %s)", fi_->name,
                         JoinValues(args_, ",").c_str());
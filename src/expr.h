@@ -15,6 +15,7 @@
 #ifndef EXPR_H_
 #define EXPR_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -24,11 +25,19 @@
 using namespace std;
 
 class Evaluator;
+class Rope;
+class SymbolSet;
 
 class Evaluable {
  public:
   virtual void Eval(Evaluator* ev, string* s) const = 0;
   string Eval(Evaluator*) const;
+  // Like Eval, but a reference to a simple variable returns its buffer
+  // instead of a copy. The result must not be modified.
+  virtual shared_ptr<string> EvalShared(Evaluator* ev) const;
+  // Appends the value to |r|, sharing the large pieces of simple variables
+  // instead of copying them.
+  virtual void EvalRope(Evaluator* ev, Rope* r) const;
   const Loc& Location() const { return loc_; }
   // Whether this Evaluable is either knowably a function (e.g. one of the
   // built-ins) or likely to be a function-type macro (i.e. one that has
@@ -62,6 +71,15 @@ class Value : public Evaluable {
   virtual bool IsLiteral() const { return false; }
   // Only safe after IsLiteral() returns true.
   virtual StringPiece GetLiteralValueUnsafe() const { return ""; }
+  // Appends the commands of $(shell) calls in this value whose argument
+  // is a literal, and returns whether evaluating the value does nothing
+  // else with side effects. References to recursive variables, or to ones
+  // in |deferred_vars|, may run anything.
+  virtual bool GetSpeculativeShellCommands(Evaluator*,
+                                           const SymbolSet&,
+                                           vector<StringPiece>*) const {
+    return false;
+  }
 
   static string DebugString(const Value*);
 
@@ -0,0 +1,504 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// +build ignore
+
+#include "file_tracer.h"
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define HAS_FILE_TRACER 1
+#endif
+
+#ifdef HAS_FILE_TRACER
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <unordered_map>
+#include <unordered_set>
+#endif
+
+#include "fileutil.h"
+#include "log.h"
+#include "process.h"
+#include "stringprintf.h"
+#include "strutil.h"
+
+#ifdef HAS_FILE_TRACER
+
+#ifndef PTRACE_GET_SYSCALL_INFO
+#define PTRACE_GET_SYSCALL_INFO 0x420e
+#endif
+
+namespace {
+
+// PTRACE_CONT is an enum member in glibc but a plain int elsewhere.
+typedef decltype(PTRACE_CONT) PtraceRequest;
+
+#if defined(__x86_64__)
+const uint32_t kAuditArch = AUDIT_ARCH_X86_64;
+#else
+const uint32_t kAuditArch = AUDIT_ARCH_AARCH64;
+#endif
+
+// The layout of struct ptrace_syscall_info for seccomp stops, which older
+// C libraries do not declare.
+struct SyscallInfo {
+  uint8_t op;
+  uint8_t pad[3];
+  uint32_t arch;
+  uint64_t instruction_pointer;
+  uint64_t stack_pointer;
+  uint64_t nr;
+  uint64_t args[6];
+  uint32_t ret_data;
+};
+
+const uint8_t kSyscallInfoSeccomp = 3;
+
+enum class Access {
+  // Looks up the path argument.
+  READ,
+  // Like READ, but modifies the file if it is opened for writing.
+  OPEN,
+  // Has effects we do not track.
+  UNTRACKED,
+};
+
+struct TracedSyscall {
+  long nr;
+  Access access;
+  // Indices of the directory fd, path, and open flags arguments, or -1.
+  int dirfd_arg;
+  int path_arg;
+  int flags_arg;
+};
+
+const TracedSyscall kTracedSyscalls[] = {
+#ifdef SYS_open
+    {SYS_open, Access::OPEN, -1, 0, 1},
+#endif
+    {SYS_openat, Access::OPEN, 0, 1, 2},
+#ifdef SYS_stat
+    {SYS_stat, Access::READ, -1, 0, -1},
+    {SYS_lstat, Access::READ, -1, 0, -1},
+#endif
+    {SYS_newfstatat, Access::READ, 0, 1, -1},
+#ifdef SYS_statx
+    {SYS_statx, Access::READ, 0, 1, -1},
+#endif
+#ifdef SYS_access
+    {SYS_access, Access::READ, -1, 0, -1},
+#endif
+    {SYS_faccessat, Access::READ, 0, 1, -1},
+#ifdef SYS_faccessat2
+    {SYS_faccessat2, Access::READ, 0, 1, -1},
+#endif
+#ifdef SYS_readlink
+    {SYS_readlink, Access::READ, -1, 0, -1},
+#endif
+    {SYS_readlinkat, Access::READ, 0, 1, -1},
+    {SYS_execve, Access::READ, -1, 0, -1},
+    {SYS_execveat, Access::READ, 0, 1, -1},
+    {SYS_chdir, Access::READ, -1, 0, -1},
+#ifdef SYS_openat2
+    {SYS_openat2, Access::UNTRACKED, -1, -1, -1},
+#endif
+#ifdef SYS_creat
+    {SYS_creat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_mkdir, Access::UNTRACKED, -1, -1, -1},
+    {SYS_rmdir, Access::UNTRACKED, -1, -1, -1},
+    {SYS_unlink, Access::UNTRACKED, -1, -1, -1},
+    {SYS_rename, Access::UNTRACKED, -1, -1, -1},
+    {SYS_link, Access::UNTRACKED, -1, -1, -1},
+    {SYS_symlink, Access::UNTRACKED, -1, -1, -1},
+    {SYS_chmod, Access::UNTRACKED, -1, -1, -1},
+    {SYS_chown, Access::UNTRACKED, -1, -1, -1},
+    {SYS_lchown, Access::UNTRACKED, -1, -1, -1},
+    {SYS_utime, Access::UNTRACKED, -1, -1, -1},
+    {SYS_utimes, Access::UNTRACKED, -1, -1, -1},
+    {SYS_futimesat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_mknod, Access::UNTRACKED, -1, -1, -1},
+#endif
+    {SYS_truncate, Access::UNTRACKED, -1, -1, -1},
+    {SYS_mkdirat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_unlinkat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_renameat, Access::UNTRACKED, -1, -1, -1},
+#ifdef SYS_renameat2
+    {SYS_renameat2, Access::UNTRACKED, -1, -1, -1},
+#endif
+    {SYS_linkat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_symlinkat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_fchmod, Access::UNTRACKED, -1, -1, -1},
+    {SYS_fchmodat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_fchown, Access::UNTRACKED, -1, -1, -1},
+    {SYS_fchownat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_utimensat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_mknodat, Access::UNTRACKED, -1, -1, -1},
+    {SYS_socket, Access::UNTRACKED, -1, -1, -1},
+};
+
+struct sock_filter Insn(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+  struct sock_filter insn = {code, jt, jf, k};
+  return insn;
+}
+
+// Returns a seccomp filter which stops the process for the tracer on
+// each syscall in kTracedSyscalls, and on any syscall of a foreign ABI.
+vector<struct sock_filter> BuildFilter() {
+  const size_t num_syscalls =
+      sizeof(kTracedSyscalls) / sizeof(kTracedSyscalls[0]);
+  vector<struct sock_filter> prog;
+  prog.push_back(Insn(BPF_LD | BPF_W | BPF_ABS,
+                      offsetof(struct seccomp_data, arch), 0, 0));
+  prog.push_back(Insn(BPF_JMP | BPF_JEQ | BPF_K, kAuditArch, 1, 0));
+  prog.push_back(Insn(BPF_RET | BPF_K, SECCOMP_RET_TRACE, 0, 0));
+  prog.push_back(Insn(BPF_LD | BPF_W | BPF_ABS,
+                      offsetof(struct seccomp_data, nr), 0, 0));
+  // The jumps below all go to the final SECCOMP_RET_TRACE.
+  size_t trace = prog.size() + num_syscalls + 1;
+#if defined(__x86_64__)
+  trace++;
+  // x32 syscalls.
+  prog.push_back(Insn(BPF_JMP | BPF_JGE | BPF_K, 0x40000000,
+                      trace - prog.size() - 1, 0));
+#endif
+  for (const TracedSyscall& sc : kTracedSyscalls) {
+    prog.push_back(Insn(BPF_JMP | BPF_JEQ | BPF_K, sc.nr,
+                        trace - prog.size() - 1, 0));
+  }
+  prog.push_back(Insn(BPF_RET | BPF_K, SECCOMP_RET_ALLOW, 0, 0));
+  prog.push_back(Insn(BPF_RET | BPF_K, SECCOMP_RET_TRACE, 0, 0));
+  CHECK(prog.size() == trace + 1);
+  return prog;
+}
+
+bool ReadLink(const string& path, string* out) {
+  char buf[PATH_MAX];
+  ssize_t r = readlink(path.c_str(), buf, sizeof(buf));
+  if (r < 0)
+    return false;
+  out->assign(buf, r);
+  return true;
+}
+
+// Reads a NUL terminated string at |addr| in the memory of |pid|.
+bool ReadString(pid_t pid, uint64_t addr, string* s) {
+  // Never read across a page boundary, which may be unmapped.
+  const uint64_t kPageSize = 4096;
+  char buf[kPageSize];
+  while (s->size() < PATH_MAX) {
+    size_t len = kPageSize - addr % kPageSize;
+    struct iovec local = {buf, len};
+    struct iovec remote = {reinterpret_cast<void*>(addr), len};
+    ssize_t r = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    if (r <= 0)
+      return false;
+    const char* end = static_cast<const char*>(memchr(buf, 0, r));
+    if (end) {
+      s->append(buf, end - buf);
+      return true;
+    }
+    s->append(buf, r);
+    addr += r;
+  }
+  return false;
+}
+
+class Tracer {
+ public:
+  Tracer() : complete_(true), saw_exec_(false) {}
+
+  // Runs |argv| with its stdout going to |out_fd|.
+  void Run(const vector<string>& argv, int out_fd) {
+    vector<struct sock_filter> filter = BuildFilter();
+    struct sock_fprog prog;
+    prog.len = filter.size();
+    prog.filter = filter.data();
+    vector<char*> args;
+    for (const string& a : argv)
+      args.push_back(const_cast<char*>(a.c_str()));
+    args.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0)
+      PERROR("fork failed");
+    if (pid == 0) {
+      dup2(out_fd, 1);
+      close(out_fd);
+      // If anything here fails, the command still runs but the tracer
+      // sees no exec and reports the inputs as incomplete.
+      if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == 0) {
+        raise(SIGSTOP);
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0)
+          prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+      }
+      execv(args[0], args.data());
+      _exit(127);
+    }
+    close(out_fd);
+
+    int status;
+    if (HANDLE_EINTR(waitpid(pid, &status, 0)) < 0)
+      PERROR("waitpid failed");
+    if (!WIFSTOPPED(status)) {
+      complete_ = false;
+      return;
+    }
+    const long options = PTRACE_O_EXITKILL | PTRACE_O_TRACESECCOMP |
+                         PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+                         PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, options) < 0) {
+      complete_ = false;
+      // Let it run untraced.
+      ptrace(PTRACE_DETACH, pid, NULL, NULL);
+    } else {
+      ptrace(PTRACE_CONT, pid, NULL, NULL);
+    }
+    seen_.insert(pid);
+    Loop();
+    if (!saw_exec_)
+      complete_ = false;
+  }
+
+  bool complete() const { return complete_; }
+  const unordered_map<string, bool>& inputs() const { return inputs_; }
+
+ private:
+  void Loop() {
+    for (;;) {
+      int status;
+      pid_t pid = waitpid(-1, &status, __WALL);
+      if (pid < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno != ECHILD)
+          PERROR("waitpid failed");
+        return;
+      }
+      if (!WIFSTOPPED(status))
+        continue;
+
+      int sig = WSTOPSIG(status);
+      int event = status >> 16;
+      if (seen_.insert(pid).second && sig == SIGSTOP) {
+        // The initial stop of a new child.
+        sig = 0;
+      } else if (event == PTRACE_EVENT_SECCOMP) {
+        HandleSyscall(pid);
+        sig = 0;
+      } else if (event != 0) {
+        sig = 0;
+      } else if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN ||
+                 sig == SIGTTOU) {
+        // Nobody would resume it.
+        sig = 0;
+      }
+      ptrace(PTRACE_CONT, pid, NULL, sig);
+    }
+  }
+
+  void HandleSyscall(pid_t pid) {
+    SyscallInfo info;
+    long r = ptrace(static_cast<PtraceRequest>(PTRACE_GET_SYSCALL_INFO), pid,
+                    sizeof(info), &info);
+    if (r <= 0 || info.op != kSyscallInfoSeccomp || info.arch != kAuditArch) {
+      complete_ = false;
+      return;
+    }
+
+    const TracedSyscall* sc = NULL;
+    for (const TracedSyscall& s : kTracedSyscalls) {
+      if (static_cast<uint64_t>(s.nr) == info.nr)
+        sc = &s;
+    }
+    if (!sc || sc->access == Access::UNTRACKED) {
+      complete_ = false;
+      return;
+    }
+    if (info.nr == SYS_execve || info.nr == SYS_execveat)
+      saw_exec_ = true;
+
+    string path;
+    if (!GetPath(pid, info, *sc, &path)) {
+      complete_ = false;
+      return;
+    }
+    if (sc->access == Access::OPEN) {
+      int flags = static_cast<int>(info.args[sc->flags_arg]);
+      if ((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC))) {
+        if (path != "/dev/null")
+          complete_ = false;
+        return;
+      }
+    }
+    AddInput(path, sc->access == Access::OPEN);
+  }
+
+  bool GetPath(pid_t pid,
+               const SyscallInfo& info,
+               const TracedSyscall& sc,
+               string* path) {
+    if (!ReadString(pid, info.args[sc.path_arg], path))
+      return false;
+    if (path->empty() || (*path)[0] == '/')
+      return true;
+
+    int dirfd = AT_FDCWD;
+    if (sc.dirfd_arg >= 0)
+      dirfd = static_cast<int>(info.args[sc.dirfd_arg]);
+    string dir;
+    if (dirfd == AT_FDCWD) {
+      if (!ReadLink(StringPrintf("/proc/%d/cwd", pid), &dir))
+        return false;
+    } else {
+      if (!ReadLink(StringPrintf("/proc/%d/fd/%d", pid, dirfd), &dir))
+        return false;
+    }
+    if (dir != "/")
+      dir += '/';
+    *path = dir + *path;
+    return true;
+  }
+
+  void AddInput(const string& path, bool opened) {
+    // An empty path with AT_EMPTY_PATH refers to a file opened before.
+    if (path.empty() || path == "/dev/null")
+      return;
+    if (HasPrefix(path, "/dev/") || HasPrefix(path, "/proc/") ||
+        HasPrefix(path, "/sys/")) {
+      complete_ = false;
+      return;
+    }
+    inputs_[path] |= opened;
+  }
+
+  bool complete_;
+  bool saw_exec_;
+  unordered_set<pid_t> seen_;
+  // Whether each input was opened.
+  unordered_map<string, bool> inputs_;
+};
+
+void WriteAll(int fd, const string& buf) {
+  size_t done = 0;
+  while (done < buf.size()) {
+    ssize_t r = HANDLE_EINTR(write(fd, buf.data() + done, buf.size() - done));
+    if (r < 0)
+      PERROR("write failed");
+    done += r;
+  }
+}
+
+void ReadAll(int fd, string* buf) {
+  char tmp[4096];
+  for (;;) {
+    ssize_t r = HANDLE_EINTR(read(fd, tmp, sizeof(tmp)));
+    if (r < 0)
+      PERROR("read failed");
+    if (r == 0)
+      return;
+    buf->append(tmp, r);
+  }
+}
+
+}  // namespace
+
+bool RunTracedCommand(const string& shell,
+                      const string& shellflag,
+                      const string& cmd,
+                      string* out,
+                      vector<TracedInput>* inputs) {
+  vector<string> argv;
+  GetShellArgv(shell, shellflag, cmd, &argv);
+
+  // The tracer waits for any child, so it runs in a process of its own
+  // where the command's processes are the only children. It reports a
+  // completeness byte followed by the inputs, each of which is 'o' if it
+  // was opened or 'l' otherwise, and the NUL terminated path.
+  int out_pipe[2];
+  int report_pipe[2];
+  if (pipe2(out_pipe, O_CLOEXEC) != 0 || pipe2(report_pipe, O_CLOEXEC) != 0)
+    PERROR("pipe failed");
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0)
+    PERROR("fork failed");
+  if (pid == 0) {
+    close(out_pipe[0]);
+    close(report_pipe[0]);
+    Tracer tracer;
+    tracer.Run(argv, out_pipe[1]);
+    string report = tracer.complete() ? "1" : "0";
+    for (const auto& input : tracer.inputs()) {
+      report += input.second ? 'o' : 'l';
+      report += input.first;
+      report += '\0';
+    }
+    WriteAll(report_pipe[1], report);
+    _exit(0);
+  }
+  close(out_pipe[1]);
+  close(report_pipe[1]);
+
+  ReadAll(out_pipe[0], out);
+  string report;
+  ReadAll(report_pipe[0], &report);
+  close(out_pipe[0]);
+  close(report_pipe[0]);
+  int status;
+  if (HANDLE_EINTR(waitpid(pid, &status, 0)) < 0)
+    PERROR("waitpid failed");
+
+  if (status != 0 || report.empty() || report[0] != '1')
+    return false;
+  size_t start = 1;
+  for (size_t i = start; i < report.size(); i++) {
+    if (report[i] == '\0') {
+      TracedInput input;
+      input.opened = report[start] == 'o';
+      input.path = report.substr(start + 1, i - start - 1);
+      inputs->push_back(input);
+      start = i + 1;
+    }
+  }
+  return true;
+}
+
+#else  // HAS_FILE_TRACER
+
+bool RunTracedCommand(const string& shell,
+                      const string& shellflag,
+                      const string& cmd,
+                      string* out,
+                      vector<TracedInput>*) {
+  RunCommand(shell, shellflag, cmd, RedirectStderr::NONE, out);
+  return false;
+}
+
+#endif  // HAS_FILE_TRACER
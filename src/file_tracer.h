@@ -0,0 +1,42 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FILE_TRACER_H_
+#define FILE_TRACER_H_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct TracedInput {
+  string path;
+  // Whether the file or directory was opened, rather than only looked up,
+  // e.g. by stat or exec.
+  bool opened;
+};
+
+// Runs |cmd| with |shell| and appends its stdout to |out|, recording the
+// files and directories it and its children looked up in |inputs|.
+// Returns true if |inputs| is complete and the command did not modify
+// any file or open a socket, i.e. running it again with the same inputs
+// should print the same output. Returns false otherwise, or if tracing is
+// not supported on this host; |out| is filled in either case.
+bool RunTracedCommand(const string& shell,
+                      const string& shellflag,
+                      const string& cmd,
+                      string* out,
+                      vector<TracedInput>* inputs);
+
+#endif  // FILE_TRACER_H_
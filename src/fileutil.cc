@@ -16,22 +16,24 @@
 
 #include "fileutil.h"
 
+#include <dirent.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <glob.h>
 #include <limits.h>
-#include <signal.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
 #if defined(__APPLE__)
 #include <mach-o/dyld.h>
 #endif
 
+#include <algorithm>
+#include <mutex>
 #include <unordered_map>
 
+#include "find.h"
 #include "log.h"
+#include "process.h"
 #include "strutil.h"
 
 bool Exists(StringPiece filename) {
@@ -60,76 +62,57 @@ double GetTimestamp(StringPiece filename) {
   return GetTimestampFromStat(st);
 }
 
+namespace {
+
+// Shell builtins and keywords, which must not be run without a shell even
+// if an executable of the same name exists.
+const char* const kShellBuiltins[] = {
+    ".",        ":",       "[",       "alias",   "bg",      "break",
+    "builtin",  "case",    "cd",      "command", "continue", "declare",
+    "do",       "done",    "echo",    "elif",    "else",    "eval",
+    "exec",     "exit",    "export",  "false",   "fc",      "fg",
+    "fi",       "for",     "function", "getopts", "hash",   "if",
+    "jobs",     "kill",    "let",     "local",   "login",   "logout",
+    "printf",   "pwd",     "read",    "readonly", "return", "select",
+    "set",      "shift",   "source",  "test",    "then",    "time",
+    "times",    "trap",    "true",    "type",    "typeset", "ulimit",
+    "umask",    "unalias", "unset",   "until",   "wait",    "while",
+};
+
+}  // namespace
+
+bool SplitSimpleCommand(StringPiece cmd, vector<StringPiece>* argv) {
+  // Anything the shell would interpret: quoting, expansions, globs,
+  // redirections, pipelines, lists, comments and line breaks.
+  static const char kShellChars[] = "\"'`$\\*?[]{}()<>|&;#~!^\n\r";
+  if (cmd.find_first_of(StringPiece(kShellChars)) != string::npos)
+    return false;
+  argv->clear();
+  for (StringPiece tok : WordScanner(cmd))
+    argv->push_back(tok);
+  if (argv->empty())
+    return false;
+  StringPiece name = (*argv)[0];
+  // A variable assignment.
+  if (name.find('=') != string::npos)
+    return false;
+  for (const char* builtin : kShellBuiltins) {
+    if (name == builtin)
+      return false;
+  }
+  return true;
+}
+
 int RunCommand(const string& shell,
                const string& shellflag,
                const string& cmd,
                RedirectStderr redirect_stderr,
                string* s) {
-  const char* argv[] = {NULL, NULL, NULL, NULL};
-  string cmd_with_shell;
-  if (shell[0] != '/' || shell.find_first_of(" $") != string::npos) {
-    string cmd_escaped = cmd;
-    EscapeShell(&cmd_escaped);
-    cmd_with_shell = shell + " " + shellflag + " \"" + cmd_escaped + "\"";
-    argv[0] = "/bin/sh";
-    argv[1] = "-c";
-    argv[2] = cmd_with_shell.c_str();
-  } else {
-    // If the shell isn't complicated, we don't need to wrap in /bin/sh
-    argv[0] = shell.c_str();
-    argv[1] = shellflag.c_str();
-    argv[2] = cmd.c_str();
-  }
-
-  int pipefd[2];
-  if (pipe(pipefd) != 0)
-    PERROR("pipe failed");
-  int pid;
-  if ((pid = vfork())) {
-    int status;
-    close(pipefd[1]);
-    while (true) {
-      int result = waitpid(pid, &status, WNOHANG);
-      if (result < 0)
-        PERROR("waitpid failed");
-
-      while (true) {
-        char buf[4096];
-        ssize_t r = HANDLE_EINTR(read(pipefd[0], buf, 4096));
-        if (r < 0)
-          PERROR("read failed");
-        if (r == 0)
-          break;
-        s->append(buf, buf + r);
-      }
-
-      if (result != 0) {
-        break;
-      }
-    }
-    close(pipefd[0]);
-
-    return status;
-  } else {
-    close(pipefd[0]);
-    if (redirect_stderr == RedirectStderr::STDOUT) {
-      if (dup2(pipefd[1], 2) < 0)
-        PERROR("dup2 failed");
-    } else if (redirect_stderr == RedirectStderr::DEV_NULL) {
-      int fd = open("/dev/null", O_WRONLY);
-      if (dup2(fd, 2) < 0)
-        PERROR("dup2 failed");
-      close(fd);
-    }
-    if (dup2(pipefd[1], 1) < 0)
-      PERROR("dup2 failed");
-    close(pipefd[1]);
-
-    execvp(argv[0], const_cast<char**>(argv));
-    PLOG("execvp for %s failed", argv[0]);
-    kill(getppid(), SIGTERM);
-    _exit(1);
-  }
+  ProcessRunner runner;
+  runner.Start(shell, shellflag, cmd, redirect_stderr);
+  unique_ptr<Subprocess> p(runner.Wait());
+  *s += p->output;
+  return p->status;
 }
 
 void GetExecutablePath(string* path) {
@@ -156,42 +139,136 @@ void GetExecutablePath(string* path) {
 
 namespace {
 
+// The directories glob(3) has read on this thread, or the directories in
+// which it looked up a literal path component. Adding or removing an entry
+// changes the mtime of one of them.
+thread_local vector<string>* g_glob_read_dirs;
+
+void* GlobOpenDir(const char* name) {
+  g_glob_read_dirs->push_back(name);
+  return opendir(name);
+}
+
+struct dirent* GlobReadDir(void* dir) {
+  return readdir(static_cast<DIR*>(dir));
+}
+
+void GlobCloseDir(void* dir) {
+  closedir(static_cast<DIR*>(dir));
+}
+
+int GlobLstat(const char* name, struct stat* st) {
+  StringPiece dir = Dirname(name);
+  g_glob_read_dirs->push_back(dir.empty() ? "/" : dir.as_string());
+  return lstat(name, st);
+}
+
+// Results of Glob(), sharded by pattern so threads globbing different
+// patterns rarely wait for each other. Entries live until Clear(), so the
+// returned vectors may be used without holding a lock.
 class GlobCache {
  public:
+  GlobCache() : use_find_emulator_(true) {}
   ~GlobCache() { Clear(); }
 
   void Get(const char* pat, vector<string>** files) {
-    auto p = cache_.emplace(pat, nullptr);
+    Shard* shard = GetShard(pat);
+    unique_lock<mutex> lock(shard->mu);
+    auto p = shard->cache.emplace(pat, nullptr);
     if (p.second) {
-      vector<string>* files = p.first->second = new vector<string>;
+      Entry* e = p.first->second = new Entry;
       if (strcspn(pat, "?*[\\") != strlen(pat)) {
-        glob_t gl;
-        glob(pat, 0, NULL, &gl);
-        for (size_t i = 0; i < gl.gl_pathc; i++) {
-          files->push_back(gl.gl_pathv[i]);
+        FindEmulator* fe = use_find_emulator_ ? FindEmulator::Get() : NULL;
+        if (fe && fe->HandleGlob(pat, &e->files, &e->read_dirs)) {
+#ifdef TEST_FIND_EMULATOR
+          vector<string> files2, read_dirs2;
+          LibcGlob(pat, &files2, &read_dirs2);
+          if (e->files != files2) {
+            ERROR("FindEmulator is broken: wildcard %s\n%s\nvs\n%s", pat,
+                  JoinStrings(e->files, " ").c_str(),
+                  JoinStrings(files2, " ").c_str());
+          }
+#endif
+        } else {
+          LibcGlob(pat, &e->files, &e->read_dirs);
         }
-        globfree(&gl);
       } else {
         if (Exists(pat))
-          files->push_back(pat);
+          e->files.push_back(pat);
       }
     }
-    *files = p.first->second;
+    *files = &p.first->second->files;
+  }
+
+  void GetAll(unordered_map<string, vector<string>*>* out) {
+    for (Shard& shard : shards_) {
+      unique_lock<mutex> lock(shard.mu);
+      for (auto& p : shard.cache)
+        out->emplace(p.first, &p.second->files);
+    }
   }
 
-  const unordered_map<string, vector<string>*>& GetAll() const {
-    return cache_;
+  void GetReadDirs(const string& pat, vector<string>* dirs) {
+    Shard* shard = GetShard(pat);
+    unique_lock<mutex> lock(shard->mu);
+    auto found = shard->cache.find(pat);
+    if (found != shard->cache.end()) {
+      const vector<string>& read_dirs = found->second->read_dirs;
+      dirs->insert(dirs->end(), read_dirs.begin(), read_dirs.end());
+    }
   }
 
+  void DisableFindEmulator() { use_find_emulator_ = false; }
+
   void Clear() {
-    for (auto& p : cache_) {
-      delete p.second;
+    for (Shard& shard : shards_) {
+      unique_lock<mutex> lock(shard.mu);
+      for (auto& p : shard.cache) {
+        delete p.second;
+      }
+      shard.cache.clear();
     }
-    cache_.clear();
   }
 
  private:
-  unordered_map<string, vector<string>*> cache_;
+  struct Entry {
+    vector<string> files;
+    vector<string> read_dirs;
+  };
+
+  struct Shard {
+    mutex mu;
+    unordered_map<string, Entry*> cache;
+  };
+
+  static void LibcGlob(const char* pat,
+                       vector<string>* files,
+                       vector<string>* read_dirs) {
+    glob_t gl = {};
+    gl.gl_opendir = GlobOpenDir;
+    gl.gl_readdir = GlobReadDir;
+    gl.gl_closedir = GlobCloseDir;
+    gl.gl_lstat = GlobLstat;
+    gl.gl_stat = stat;
+    g_glob_read_dirs = read_dirs;
+    glob(pat, GLOB_ALTDIRFUNC, NULL, &gl);
+    g_glob_read_dirs = NULL;
+    for (size_t i = 0; i < gl.gl_pathc; i++) {
+      files->push_back(gl.gl_pathv[i]);
+    }
+    globfree(&gl);
+    sort(read_dirs->begin(), read_dirs->end());
+    read_dirs->erase(unique(read_dirs->begin(), read_dirs->end()),
+                     read_dirs->end());
+  }
+
+  Shard* GetShard(StringPiece pat) {
+    return &shards_[hash<StringPiece>()(pat) % kNumShards];
+  }
+
+  static const size_t kNumShards = 16;
+  Shard shards_[kNumShards];
+  bool use_find_emulator_;
 };
 
 static GlobCache g_gc;
@@ -202,8 +279,16 @@ void Glob(const char* pat, vector<string>** files) {
   g_gc.Get(pat, files);
 }
 
-const unordered_map<string, vector<string>*>& GetAllGlobCache() {
-  return g_gc.GetAll();
+void GetAllGlobCache(unordered_map<string, vector<string>*>* out) {
+  g_gc.GetAll(out);
+}
+
+void GetGlobReadDirs(const string& pat, vector<string>* dirs) {
+  g_gc.GetReadDirs(pat, dirs);
+}
+
+void DisableGlobWithFindEmulator() {
+  g_gc.DisableFindEmulator();
 }
 
 void ClearGlobCache() {
@@ -42,11 +42,26 @@ int RunCommand(const string& shell,
                RedirectStderr redirect_stderr,
                string* out);
 
+// Splits |cmd| into words if a POSIX shell would run it as a plain exec of
+// those words. Commands which are run this way skip the shell entirely.
+// Exposed only for test.
+bool SplitSimpleCommand(StringPiece cmd, vector<StringPiece>* argv);
+
 void GetExecutablePath(string* path);
 
+// Thread safe. The returned vector is owned by the cache.
 void Glob(const char* pat, vector<string>** files);
 
-const unordered_map<string, vector<string>*>& GetAllGlobCache();
+void GetAllGlobCache(unordered_map<string, vector<string>*>* out);
+
+// Appends the directories which were read to expand the cached wildcard
+// |pat|. Its result cannot change unless one of them is modified. Nothing
+// is appended for patterns without wildcards.
+void GetGlobReadDirs(const string& pat, vector<string>* dirs);
+
+// Makes Glob() read directories again instead of using the ones the find
+// emulator read, which are stale once commands start to run.
+void DisableGlobWithFindEmulator();
 
 void ClearGlobCache();
 
@@ -42,4 +42,15 @@ static void BM_RunCommand_ComplexShell(benchmark::State& state) {
 }
 BENCHMARK(BM_RunCommand_ComplexShell);
 
+static void BM_RunCommand_NoShell(benchmark::State& state) {
+  std::string shell = "/bin/bash";
+  std::string shellflag = "-c";
+  std::string cmd = "/bin/true";
+  while (state.KeepRunning()) {
+    std::string result;
+    RunCommand(shell, shellflag, cmd, RedirectStderr::NONE, &result);
+  }
+}
+BENCHMARK(BM_RunCommand_NoShell);
+
 BENCHMARK_MAIN();
@@ -0,0 +1,70 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// +build ignore
+
+#include "fileutil.h"
+
+#include <assert.h>
+
+#include "strutil.h"
+#include "testutil.h"
+
+namespace {
+
+string Split(StringPiece cmd) {
+  vector<StringPiece> argv;
+  if (!SplitSimpleCommand(cmd, &argv))
+    return "*shell*";
+  string r;
+  for (StringPiece a : argv) {
+    if (!r.empty())
+      r += '|';
+    a.AppendToString(&r);
+  }
+  return r;
+}
+
+void TestSplitSimpleCommand() {
+  ASSERT_EQ(Split("mkdir -p out/obj"), "mkdir|-p|out/obj");
+  ASSERT_EQ(Split("  cp\tfoo.c  out/foo.c "), "cp|foo.c|out/foo.c");
+  ASSERT_EQ(Split("gcc -DFOO=1 -c foo.c -o foo.o"),
+            "gcc|-DFOO=1|-c|foo.c|-o|foo.o");
+  ASSERT_EQ(Split("./tool --flag=a,b:c@d%e+f"), "./tool|--flag=a,b:c@d%e+f");
+
+  ASSERT_EQ(Split(""), "*shell*");
+  ASSERT_EQ(Split("   "), "*shell*");
+  ASSERT_EQ(Split("echo foo"), "*shell*");
+  ASSERT_EQ(Split("cd out"), "*shell*");
+  ASSERT_EQ(Split("true"), "*shell*");
+  ASSERT_EQ(Split("FOO=bar make"), "*shell*");
+  ASSERT_EQ(Split("rm -f *.o"), "*shell*");
+  ASSERT_EQ(Split("cat foo > bar"), "*shell*");
+  ASSERT_EQ(Split("touch foo && touch bar"), "*shell*");
+  ASSERT_EQ(Split("touch foo; touch bar"), "*shell*");
+  ASSERT_EQ(Split("ls | wc"), "*shell*");
+  ASSERT_EQ(Split("cp 'a b' c"), "*shell*");
+  ASSERT_EQ(Split("cp a\\ b c"), "*shell*");
+  ASSERT_EQ(Split("cp $HOME/a b"), "*shell*");
+  ASSERT_EQ(Split("cp ~/a b"), "*shell*");
+  ASSERT_EQ(Split("touch a # comment"), "*shell*");
+  ASSERT_EQ(Split("touch a\ntouch b"), "*shell*");
+}
+
+}  // namespace
+
+int main() {
+  TestSplitSimpleCommand();
+  assert(!g_failed);
+}
@@ -25,6 +25,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 //#undef NOLOG
@@ -157,6 +158,9 @@ class DirentNode {
 
   virtual bool IsDirectory() const = 0;
 
+  // Whether the directory at |path| may have changed since it was read.
+  virtual bool HasChanged(const string&) const { return false; }
+
   const string& base() const { return base_; }
 
  protected:
@@ -309,7 +313,7 @@ class DirentDirNode : public DirentNode {
     }
 
     bool is_wild = p.find_first_of("?*[") != string::npos;
-    if (is_wild) {
+    if (is_wild || fc.records_lookups) {
       fc.read_dirs->insert(*path);
     }
 
@@ -429,6 +433,10 @@ class DirentDirNode : public DirentNode {
 
   virtual bool IsDirectory() const override { return true; }
 
+  virtual bool HasChanged(const string& path) const override {
+    return is_initialized_ && GetTimestamp(path) != mtime_;
+  }
+
  private:
   static unsigned char GetDtTypeFromStat(const struct stat& st) {
     if (S_ISREG(st.st_mode)) {
@@ -465,6 +473,10 @@ class DirentDirNode : public DirentNode {
   mutable vector<pair<string, DirentNode*>> children_;
   mutable string name_;
   mutable bool is_initialized_ = false;
+  // The timestamp of the directory when it was read, or a negative value
+  // if it is unknown or was too close to the time it was read to tell
+  // later changes from earlier ones.
+  mutable double mtime_ = -1.0;
 };
 
 class DirentSymlinkNode : public DirentNode {
@@ -592,6 +604,14 @@ void DirentDirNode::initialize() const {
     }
   }
 
+  // File timestamps may lag behind GetTime() by a clock tick.
+  struct stat st;
+  if (fstat(dirfd(dir), &st) == 0) {
+    double mtime = GetTimestampFromStat(st);
+    if (mtime < GetTime() - 1.0)
+      mtime_ = mtime;
+  }
+
   struct dirent* ent;
   while ((ent = readdir(dir)) != NULL) {
     if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..") ||
@@ -1123,8 +1143,85 @@ class FindEmulatorImpl : public FindEmulator {
     return true;
   }
 
+  virtual bool HandleGlob(StringPiece pat,
+                          vector<string>* files,
+                          vector<string>* read_dirs) override {
+    if (!CanHandle(pat) || pat.empty() || pat.find('\\') != string::npos ||
+        pat.find("//") != string::npos || pat[pat.size() - 1] == '/') {
+      return false;
+    }
+    // The tree has no entries for these, and glob would return "." and
+    // ".." for patterns which match a leading period.
+    for (StringPiece p = pat; !p.empty();) {
+      size_t index = p.find('/');
+      StringPiece comp = p.substr(0, index);
+      if (comp == ".repo" || comp == ".git")
+        return false;
+      if (comp[0] == '.' && comp.find_first_of("?*[") != string::npos)
+        return false;
+      p = index == string::npos ? StringPiece() : p.substr(index + 1);
+    }
+
+    // Like glob(3), start from the directory named by the components
+    // before the first wildcard without looking them up one by one.
+    size_t slash = pat.rfind('/', pat.find_first_of("?*["));
+    StringPiece dir = slash == string::npos ? "" : pat.substr(0, slash);
+    StringPiece rest = slash == string::npos ? pat : pat.substr(slash + 1);
+
+    unique_lock<mutex> lock(glob_mu_);
+    FindCommand fc;
+    fc.records_lookups = true;
+    fc.read_dirs->insert(dir.as_string());
+    bool should_fallback = false;
+    const DirentNode* node = FindDir(dir, &should_fallback);
+    // The directory exists but is not in the tree, e.g. behind a symlink
+    // which points out of it. Only a directory known not to exist has no
+    // matches.
+    if (!node && should_fallback)
+      return false;
+    string path = dir.as_string();
+    vector<pair<string, const DirentNode*>> results;
+    if (node && !node->FindNodes(fc, results, &path, rest))
+      return false;
+    size_t orig_read_dirs_size = read_dirs->size();
+    for (string d : *fc.read_dirs) {
+      if (!d.empty() && d[d.size() - 1] == '/')
+        d.resize(d.size() - 1);
+      if (d.empty())
+        d = ".";
+      // The tree is never updated, so the result may be stale if one of
+      // these directories changed since it was read.
+      if (fs_changed_) {
+        const DirentNode* n = root_->FindDir(d);
+        if (!n || n->HasChanged(d)) {
+          LOG("FindEmulator: %s changed, cannot glob %.*s", d.c_str(),
+              SPF(pat));
+          read_dirs->resize(orig_read_dirs_size);
+          return false;
+        }
+      }
+      read_dirs->push_back(d);
+    }
+    for (const auto& r : results)
+      files->push_back(r.first);
+    sort(read_dirs->begin(), read_dirs->end());
+    read_dirs->erase(unique(read_dirs->begin(), read_dirs->end()),
+                     read_dirs->end());
+    // glob(3) sorts its whole result.
+    sort(files->begin(), files->end());
+    return true;
+  }
+
+  virtual void OnFileSystemChanged() override {
+    unique_lock<mutex> lock(glob_mu_);
+    fs_changed_ = true;
+  }
+
  private:
   DirentNode* root_ = new DirentDirNode(nullptr, "");
+  // The tree is read lazily, so concurrent globs must not walk it at once.
+  mutex glob_mu_;
+  bool fs_changed_ = false;
 };
 
 }  // namespace
@@ -1134,6 +1231,7 @@ FindCommand::FindCommand()
       depth(INT_MAX),
       mindepth(INT_MIN),
       redirect_to_devnull(false),
+      records_lookups(false),
       found_files(new vector<string>()),
       read_dirs(new unordered_set<string>()) {}
 
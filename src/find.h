@@ -49,6 +49,9 @@ struct FindCommand {
   int depth;
   int mindepth;
   bool redirect_to_devnull;
+  // Whether FindNodes also records the directories in which it looks up a
+  // literal path component, as wildcards depend on them.
+  bool records_lookups;
 
   unique_ptr<vector<string>> found_files;
   unique_ptr<unordered_set<string>> read_dirs;
@@ -67,6 +70,20 @@ class FindEmulator {
                           const Loc& loc,
                           string* out) = 0;
 
+  // Expands the wildcard pattern |pat| like glob(3) using the directories
+  // already read by the emulator, and appends the directories the result
+  // depends on to |read_dirs|. Returns false if the emulator cannot handle
+  // |pat|, e.g. because it is an absolute path. Thread safe.
+  virtual bool HandleGlob(StringPiece pat,
+                          vector<string>* files,
+                          vector<string>* read_dirs) = 0;
+
+  // Called when the file system may have been changed by anything other
+  // than a find command, e.g. $(shell) or $(file >). From then on, globs
+  // are only answered from directories which did not change since they
+  // were read.
+  virtual void OnFileSystemChanged() = 0;
+
   static FindEmulator* Get();
   static unsigned int GetNodeCount();
 
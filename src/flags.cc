@@ -53,11 +53,16 @@ void Flags::Parse(int argc, char** argv) {
   num_jobs = num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
   const char* num_jobs_str;
   const char* writable_str;
+  const char* ninja_format;
 
   if (const char* makeflags = getenv("MAKEFLAGS")) {
     for (StringPiece tok : WordScanner(makeflags)) {
       if (!HasPrefix(tok, "-") && tok.find('=') != string::npos)
         cl_vars.push_back(tok);
+      if (HasPrefix(tok, "--jobserver-auth=") ||
+          HasPrefix(tok, "--jobserver-fds=")) {
+        jobserver_auth = tok.substr(tok.find('=') + 1).as_string();
+      }
     }
   }
 
@@ -106,6 +111,10 @@ void Flags::Parse(int argc, char** argv) {
       no_builtin_rules = true;
     } else if (!strcmp(arg, "--no_ninja_prelude")) {
       no_ninja_prelude = true;
+    } else if (!strcmp(arg, "--ninja_fragments")) {
+      ninja_fragments = true;
+    } else if (!strcmp(arg, "--ninja_streaming")) {
+      ninja_streaming = true;
     } else if (!strcmp(arg, "--use_ninja_phony_output")) {
       use_ninja_phony_output = true;
     } else if (!strcmp(arg, "--use_ninja_symlink_outputs")) {
@@ -159,18 +168,43 @@ void Flags::Parse(int argc, char** argv) {
       if (num_jobs <= 0) {
         ERROR("Invalid -j flag: %s", num_jobs_str);
       }
+      has_num_jobs = true;
+      // Sub-makes share our jobserver through MAKEFLAGS. Passing -j to them
+      // would make them start their own.
+      should_propagate = false;
     } else if (ParseCommandLineOptionWithArg("--remote_num_jobs", argv, &i,
                                              &num_jobs_str)) {
       remote_num_jobs = strtol(num_jobs_str, NULL, 10);
       if (remote_num_jobs <= 0) {
         ERROR("Invalid -j flag: %s", num_jobs_str);
       }
+    } else if (ParseCommandLineOptionWithArg("--ninja_shards", argv, &i,
+                                             &num_jobs_str)) {
+      ninja_shards = strtol(num_jobs_str, NULL, 10);
+      if (ninja_shards <= 0) {
+        ERROR("Invalid --ninja_shards flag: %s", num_jobs_str);
+      }
+    } else if (ParseCommandLineOptionWithArg("--ninja_format", argv, &i,
+                                             &ninja_format)) {
+      if (!strcmp(ninja_format, "binary")) {
+        ninja_binary_format = true;
+      } else if (strcmp(ninja_format, "text")) {
+        ERROR("Invalid --ninja_format flag: %s", ninja_format);
+      }
     } else if (ParseCommandLineOptionWithArg("--ninja_suffix", argv, &i,
                                              &ninja_suffix)) {
     } else if (ParseCommandLineOptionWithArg("--ninja_dir", argv, &i,
                                              &ninja_dir)) {
+    } else if (ParseCommandLineOptionWithArg("--ninja_reader", argv, &i,
+                                             &ninja_reader)) {
+    } else if (ParseCommandLineOptionWithArg("--shell_cache", argv, &i,
+                                             &shell_cache)) {
     } else if (!strcmp(arg, "--use_find_emulator")) {
       use_find_emulator = true;
+    } else if (!strcmp(arg, "--speculative_shell")) {
+      speculative_shell = true;
+    } else if (!strcmp(arg, "--memoize_recursive_vars")) {
+      memoize_recursive_vars = true;
     } else if (ParseCommandLineOptionWithArg("--goma_dir", argv, &i,
                                              &goma_dir)) {
     } else if (ParseCommandLineOptionWithArg(
@@ -202,4 +236,9 @@ void Flags::Parse(int argc, char** argv) {
       }
     }
   }
+
+  if (ninja_binary_format && !ninja_reader) {
+    ERROR("--ninja_format=binary needs --ninja_reader: "
+          "ninja cannot read the binary format");
+  }
 }
@@ -42,9 +42,23 @@ struct Flags {
   bool regen_debug;
   bool regen_ignoring_kati_binary;
   bool use_find_emulator;
+  // Start literal $(shell) commands of := assignments before they are
+  // evaluated.
+  bool speculative_shell;
+  // Reuse the expansions of recursive variables while nothing they read
+  // changes.
+  bool memoize_recursive_vars;
   bool color_warnings;
   bool no_builtin_rules;
   bool no_ninja_prelude;
+  // Emit the build statements of each makefile into a subninja file which
+  // is reused while the rules from that makefile do not change.
+  bool ninja_fragments;
+  // Emit the nodes in batches as they are evaluated, instead of holding
+  // every command until all of them are evaluated.
+  bool ninja_streaming;
+  // Write the manifest in the binary format instead of as text.
+  bool ninja_binary_format;
   bool use_ninja_phony_output;
   bool use_ninja_symlink_outputs;
   bool use_ninja_validations;
@@ -66,16 +80,27 @@ struct Flags {
   bool werror_real_no_cmds;
   const char* default_pool;
   const char* goma_dir;
+  // --jobserver-auth (or --jobserver-fds) value inherited via MAKEFLAGS.
+  string jobserver_auth;
   const char* ignore_dirty_pattern;
   const char* no_ignore_dirty_pattern;
   const char* ignore_optional_include_pattern;
   const char* makefile;
   const char* ninja_dir;
+  // The ninja which ninja.sh runs instead of the one in PATH. Required by
+  // --ninja_format=binary, which only a ninja built for it can read.
+  const char* ninja_reader;
+  const char* shell_cache;
   const char* ninja_suffix;
   const char* working_dir;  // -C <dir>
   int num_cpus;
   int num_jobs;
+  // Whether -j was given explicitly. The built-in executor runs commands
+  // serially unless it was.
+  bool has_num_jobs;
   int remote_num_jobs;
+  // The number of subninja files the build statements are split into.
+  int ninja_shards;
   vector<const char*> subkati_args;
   vector<Symbol> targets;
   vector<StringPiece> cl_vars;
@@ -35,6 +35,8 @@
 #include "loc.h"
 #include "log.h"
 #include "parser.h"
+#include "shell_cache.h"
+#include "shell_speculator.h"
 #include "stats.h"
 #include "stmt.h"
 #include "strutil.h"
@@ -101,7 +103,8 @@ void StripShellComment(string* cmd) {
 void PatsubstFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
   const string&& pat_str = args[0]->Eval(ev);
   const string&& repl = args[1]->Eval(ev);
-  const string&& str = args[2]->Eval(ev);
+  const shared_ptr<string> str_buf = args[2]->EvalShared(ev);
+  const string& str = *str_buf;
   WordWriter ww(s);
   Pattern pat(pat_str);
   for (StringPiece tok : WordScanner(str)) {
@@ -111,7 +114,8 @@ void PatsubstFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void StripFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& str = args[0]->Eval(ev);
+  const shared_ptr<string> str_buf = args[0]->EvalShared(ev);
+  const string& str = *str_buf;
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(str)) {
     ww.Write(tok);
@@ -148,7 +152,8 @@ void FindstringFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 
 void FilterFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
   const string&& pat_buf = args[0]->Eval(ev);
-  const string&& text = args[1]->Eval(ev);
+  const shared_ptr<string> text_buf = args[1]->EvalShared(ev);
+  const string& text = *text_buf;
   vector<Pattern> pats;
   for (StringPiece pat : WordScanner(pat_buf)) {
     pats.push_back(Pattern(pat));
@@ -166,7 +171,8 @@ void FilterFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 
 void FilterOutFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
   const string&& pat_buf = args[0]->Eval(ev);
-  const string&& text = args[1]->Eval(ev);
+  const shared_ptr<string> text_buf = args[1]->EvalShared(ev);
+  const string& text = *text_buf;
   vector<Pattern> pats;
   for (StringPiece pat : WordScanner(pat_buf)) {
     pats.push_back(Pattern(pat));
@@ -226,7 +232,8 @@ void WordFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
     ev->Error("*** first argument to `word' function must be greater than 0.");
   }
 
-  const string&& text = args[1]->Eval(ev);
+  const shared_ptr<string> text_buf = args[1]->EvalShared(ev);
+  const string& text = *text_buf;
   for (StringPiece tok : WordScanner(text)) {
     n--;
     if (n == 0) {
@@ -258,7 +265,8 @@ void WordlistFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
         e_str.c_str()));
   }
 
-  const string&& text = args[2]->Eval(ev);
+  const shared_ptr<string> text_buf = args[2]->EvalShared(ev);
+  const string& text = *text_buf;
   int i = 0;
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(text)) {
@@ -270,7 +278,8 @@ void WordlistFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void WordsFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& text = args[0]->Eval(ev);
+  const shared_ptr<string> text_buf = args[0]->EvalShared(ev);
+  const string& text = *text_buf;
   WordScanner ws(text);
   int n = 0;
   for (auto iter = ws.begin(); iter != ws.end(); ++iter)
@@ -281,7 +290,8 @@ void WordsFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void FirstwordFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& text = args[0]->Eval(ev);
+  const shared_ptr<string> text_buf = args[0]->EvalShared(ev);
+  const string& text = *text_buf;
   WordScanner ws(text);
   auto begin = ws.begin();
   if (begin != ws.end()) {
@@ -290,7 +300,8 @@ void FirstwordFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void LastwordFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& text = args[0]->Eval(ev);
+  const shared_ptr<string> text_buf = args[0]->EvalShared(ev);
+  const string& text = *text_buf;
   StringPiece last;
   for (StringPiece tok : WordScanner(text)) {
     last = tok;
@@ -299,8 +310,10 @@ void LastwordFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void JoinFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& list1 = args[0]->Eval(ev);
-  const string&& list2 = args[1]->Eval(ev);
+  const shared_ptr<string> list1_buf = args[0]->EvalShared(ev);
+  const string& list1 = *list1_buf;
+  const shared_ptr<string> list2_buf = args[1]->EvalShared(ev);
+  const string& list2 = *list2_buf;
   WordScanner ws1(list1);
   WordScanner ws2(list2);
   WordWriter ww(s);
@@ -334,7 +347,8 @@ void WildcardFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void DirFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& text = args[0]->Eval(ev);
+  const shared_ptr<string> text_buf = args[0]->EvalShared(ev);
+  const string& text = *text_buf;
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(text)) {
     ww.Write(Dirname(tok));
@@ -343,7 +357,8 @@ void DirFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void NotdirFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& text = args[0]->Eval(ev);
+  const shared_ptr<string> text_buf = args[0]->EvalShared(ev);
+  const string& text = *text_buf;
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(text)) {
     if (tok == "/") {
@@ -355,7 +370,8 @@ void NotdirFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void SuffixFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& text = args[0]->Eval(ev);
+  const shared_ptr<string> text_buf = args[0]->EvalShared(ev);
+  const string& text = *text_buf;
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(text)) {
     StringPiece suf = GetExt(tok);
@@ -365,7 +381,8 @@ void SuffixFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void BasenameFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& text = args[0]->Eval(ev);
+  const shared_ptr<string> text_buf = args[0]->EvalShared(ev);
+  const string& text = *text_buf;
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(text)) {
     ww.Write(StripExt(tok));
@@ -374,7 +391,8 @@ void BasenameFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 
 void AddsuffixFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
   const string&& suf = args[0]->Eval(ev);
-  const string&& text = args[1]->Eval(ev);
+  const shared_ptr<string> text_buf = args[1]->EvalShared(ev);
+  const string& text = *text_buf;
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(text)) {
     ww.Write(tok);
@@ -384,7 +402,8 @@ void AddsuffixFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 
 void AddprefixFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
   const string&& pre = args[0]->Eval(ev);
-  const string&& text = args[1]->Eval(ev);
+  const shared_ptr<string> text_buf = args[1]->EvalShared(ev);
+  const string& text = *text_buf;
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(text)) {
     ww.Write(pre);
@@ -415,7 +434,8 @@ void RealpathFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 }
 
 void AbspathFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
-  const string&& text = args[0]->Eval(ev);
+  const shared_ptr<string> text_buf = args[0]->EvalShared(ev);
+  const string& text = *text_buf;
   WordWriter ww(s);
   string buf;
   for (StringPiece tok : WordScanner(text)) {
@@ -526,8 +546,14 @@ static void ShellFuncImpl(const string& shell,
     *fc = NULL;
   }
 
+  if (FindEmulator::Get())
+    FindEmulator::Get()->OnFileSystemChanged();
+
   COLLECT_STATS_WITH_SLOW_REPORT("func shell time", cmd.c_str());
-  RunCommand(shell, shellflag, cmd, RedirectStderr::NONE, s);
+  if (!TakeSpeculativeShellResult(shell, shellflag, cmd, s) &&
+      !RunShellCommandWithCache(shell, shellflag, cmd, s)) {
+    RunCommand(shell, shellflag, cmd, RedirectStderr::NONE, s);
+  }
   FormatForCommandSubstitution(s);
 
 #ifdef TEST_FIND_EMULATOR
@@ -652,13 +678,15 @@ void CallFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
 
 void ForeachFunc(const vector<Value*>& args, Evaluator* ev, string* s) {
   const string&& varname = args[0]->Eval(ev);
-  const string&& list = args[1]->Eval(ev);
+  const shared_ptr<string> list_buf = args[1]->EvalShared(ev);
+  const string& list = *list_buf;
   ev->DecrementEvalDepth();
+  Symbol var_sym = Intern(varname);
   WordWriter ww(s);
   for (StringPiece tok : WordScanner(list)) {
     unique_ptr<SimpleVar> v(
-        new SimpleVar(tok.as_string(), VarOrigin::AUTOMATIC, nullptr, Loc()));
-    ScopedGlobalVar sv(Intern(varname), v.get());
+        new SimpleVar(tok, VarOrigin::AUTOMATIC, nullptr, Loc()));
+    ScopedGlobalVar sv(var_sym, v.get());
     ww.MaybeAddWhitespace();
     args[2]->Eval(ev, s);
   }
@@ -773,6 +801,8 @@ static void FileWriteFunc(Evaluator* ev,
   if (fclose(f) != 0) {
     ev->Error("*** fclose failed.");
   }
+  if (FindEmulator::Get())
+    FindEmulator::Get()->OnFileSystemChanged();
 
   if (ShouldStoreCommandResult(filename)) {
     CommandResult* cr = new CommandResult();
@@ -867,6 +897,7 @@ void DeprecatedVarFunc(const vector<Value*>& args, Evaluator* ev, string*) {
     }
 
     v->SetDeprecated(msg);
+    sym.BumpGlobalVarVersion();
   }
 }
 
@@ -902,6 +933,7 @@ void ObsoleteVarFunc(const vector<Value*>& args, Evaluator* ev, string*) {
     }
 
     v->SetObsolete(msg);
+    sym.BumpGlobalVarVersion();
   }
 }
 
@@ -966,57 +998,61 @@ void VariableLocationFunc(const vector<Value*>& args,
 
 static const std::unordered_map<StringPiece, FuncInfo> g_func_info_map = {
 
-    ENTRY("patsubst", &PatsubstFunc, 3, 3, false, false),
-    ENTRY("strip", &StripFunc, 1, 1, false, false),
-    ENTRY("subst", &SubstFunc, 3, 3, false, false),
-    ENTRY("findstring", &FindstringFunc, 2, 2, false, false),
-    ENTRY("filter", &FilterFunc, 2, 2, false, false),
-    ENTRY("filter-out", &FilterOutFunc, 2, 2, false, false),
-    ENTRY("sort", &SortFunc, 1, 1, false, false),
-    ENTRY("word", &WordFunc, 2, 2, false, false),
-    ENTRY("wordlist", &WordlistFunc, 3, 3, false, false),
-    ENTRY("words", &WordsFunc, 1, 1, false, false),
-    ENTRY("firstword", &FirstwordFunc, 1, 1, false, false),
-    ENTRY("lastword", &LastwordFunc, 1, 1, false, false),
-
-    ENTRY("join", &JoinFunc, 2, 2, false, false),
-    ENTRY("wildcard", &WildcardFunc, 1, 1, false, false),
-    ENTRY("dir", &DirFunc, 1, 1, false, false),
-    ENTRY("notdir", &NotdirFunc, 1, 1, false, false),
-    ENTRY("suffix", &SuffixFunc, 1, 1, false, false),
-    ENTRY("basename", &BasenameFunc, 1, 1, false, false),
-    ENTRY("addsuffix", &AddsuffixFunc, 2, 2, false, false),
-    ENTRY("addprefix", &AddprefixFunc, 2, 2, false, false),
-    ENTRY("realpath", &RealpathFunc, 1, 1, false, false),
-    ENTRY("abspath", &AbspathFunc, 1, 1, false, false),
-
-    ENTRY("if", &IfFunc, 3, 2, false, true),
-    ENTRY("and", &AndFunc, 0, 0, true, false),
-    ENTRY("or", &OrFunc, 0, 0, true, false),
-
-    ENTRY("value", &ValueFunc, 1, 1, false, false),
-    ENTRY("eval", &EvalFunc, 1, 1, false, false),
-    ENTRY("shell", &ShellFunc, 1, 1, false, false),
-    ENTRY("call", &CallFunc, 0, 0, false, false),
-    ENTRY("foreach", &ForeachFunc, 3, 3, false, false),
-
-    ENTRY("origin", &OriginFunc, 1, 1, false, false),
-    ENTRY("flavor", &FlavorFunc, 1, 1, false, false),
-
-    ENTRY("info", &InfoFunc, 1, 1, false, false),
-    ENTRY("warning", &WarningFunc, 1, 1, false, false),
-    ENTRY("error", &ErrorFunc, 1, 1, false, false),
-
-    ENTRY("file", &FileFunc, 2, 1, false, false),
+    ENTRY("patsubst", &PatsubstFunc, 3, 3, false, false, true),
+    ENTRY("strip", &StripFunc, 1, 1, false, false, true),
+    ENTRY("subst", &SubstFunc, 3, 3, false, false, true),
+    ENTRY("findstring", &FindstringFunc, 2, 2, false, false, true),
+    ENTRY("filter", &FilterFunc, 2, 2, false, false, true),
+    ENTRY("filter-out", &FilterOutFunc, 2, 2, false, false, true),
+    ENTRY("sort", &SortFunc, 1, 1, false, false, true),
+    ENTRY("word", &WordFunc, 2, 2, false, false, true),
+    ENTRY("wordlist", &WordlistFunc, 3, 3, false, false, true),
+    ENTRY("words", &WordsFunc, 1, 1, false, false, true),
+    ENTRY("firstword", &FirstwordFunc, 1, 1, false, false, true),
+    ENTRY("lastword", &LastwordFunc, 1, 1, false, false, true),
+
+    ENTRY("join", &JoinFunc, 2, 2, false, false, true),
+    ENTRY("wildcard", &WildcardFunc, 1, 1, false, false, false),
+    ENTRY("dir", &DirFunc, 1, 1, false, false, true),
+    ENTRY("notdir", &NotdirFunc, 1, 1, false, false, true),
+    ENTRY("suffix", &SuffixFunc, 1, 1, false, false, true),
+    ENTRY("basename", &BasenameFunc, 1, 1, false, false, true),
+    ENTRY("addsuffix", &AddsuffixFunc, 2, 2, false, false, true),
+    ENTRY("addprefix", &AddprefixFunc, 2, 2, false, false, true),
+    ENTRY("realpath", &RealpathFunc, 1, 1, false, false, false),
+    ENTRY("abspath", &AbspathFunc, 1, 1, false, false, true),
+
+    ENTRY("if", &IfFunc, 3, 2, false, true, true),
+    ENTRY("and", &AndFunc, 0, 0, true, false, true),
+    ENTRY("or", &OrFunc, 0, 0, true, false, true),
+
+    ENTRY("value", &ValueFunc, 1, 1, false, false, true),
+    ENTRY("eval", &EvalFunc, 1, 1, false, false, false),
+    ENTRY("shell", &ShellFunc, 1, 1, false, false, false),
+    ENTRY("call", &CallFunc, 0, 0, false, false, true),
+    ENTRY("foreach", &ForeachFunc, 3, 3, false, false, true),
+
+    ENTRY("origin", &OriginFunc, 1, 1, false, false, true),
+    ENTRY("flavor", &FlavorFunc, 1, 1, false, false, true),
+
+    ENTRY("info", &InfoFunc, 1, 1, false, false, false),
+    ENTRY("warning", &WarningFunc, 1, 1, false, false, false),
+    ENTRY("error", &ErrorFunc, 1, 1, false, false, false),
+
+    ENTRY("file", &FileFunc, 2, 1, false, false, false),
 
     /* Kati custom extension functions */
-    ENTRY("KATI_deprecated_var", &DeprecatedVarFunc, 2, 1, false, false),
-    ENTRY("KATI_obsolete_var", &ObsoleteVarFunc, 2, 1, false, false),
-    ENTRY("KATI_deprecate_export", &DeprecateExportFunc, 1, 1, false, false),
-    ENTRY("KATI_obsolete_export", &ObsoleteExportFunc, 1, 1, false, false),
-
-    ENTRY("KATI_profile_makefile", &ProfileFunc, 0, 0, false, false),
-    ENTRY("KATI_variable_location", &VariableLocationFunc, 1, 1, false, false),
+    ENTRY("KATI_deprecated_var", &DeprecatedVarFunc, 2, 1, false, false,
+          false),
+    ENTRY("KATI_obsolete_var", &ObsoleteVarFunc, 2, 1, false, false, false),
+    ENTRY("KATI_deprecate_export", &DeprecateExportFunc, 1, 1, false, false,
+          false),
+    ENTRY("KATI_obsolete_export", &ObsoleteExportFunc, 1, 1, false, false,
+          false),
+
+    ENTRY("KATI_profile_makefile", &ProfileFunc, 0, 0, false, false, false),
+    ENTRY("KATI_variable_location", &VariableLocationFunc, 1, 1, false, false,
+          false),
 };
 
 }  // namespace
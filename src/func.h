@@ -33,6 +33,9 @@ struct FuncInfo {
   bool trim_space;
   // Only for the first parameter.
   bool trim_right_space_1st;
+  // Whether the result depends only on the arguments and the variables the
+  // function reads, so that expansions calling it can be memoized.
+  bool pure;
 };
 
 const FuncInfo* GetFuncInfo(StringPiece name);
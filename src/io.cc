@@ -16,7 +16,233 @@
 
 #include "io.h"
 
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+
+#include "fileutil.h"
 #include "log.h"
+#include "strutil.h"
+
+namespace {
+
+// The temporary files of the kReplaceIfChanged writers not closed yet.
+// They are removed if kati exits before, e.g. on an error.
+mutex g_tmp_files_mu;
+unordered_set<string>* g_tmp_files;
+
+void RemoveTmpFiles() {
+  unique_lock<mutex> lock(g_tmp_files_mu);
+  for (const string& filename : *g_tmp_files)
+    unlink(filename.c_str());
+}
+
+void AddTmpFile(const string& filename) {
+  unique_lock<mutex> lock(g_tmp_files_mu);
+  if (!g_tmp_files) {
+    g_tmp_files = new unordered_set<string>();
+    atexit(RemoveTmpFiles);
+  }
+  g_tmp_files->insert(filename);
+}
+
+void RemoveTmpFile(const string& filename) {
+  unique_lock<mutex> lock(g_tmp_files_mu);
+  g_tmp_files->erase(filename);
+}
+
+}  // namespace
+
+BufferedWriter::BufferedWriter(const string& filename, Mode mode)
+    : cur_(0), pos_(0), background_(false), hash_(0) {
+  string open_filename = filename;
+  if (mode == kReplaceIfChanged) {
+    filename_ = filename;
+    open_filename += ".tmp";
+    AddTmpFile(open_filename);
+  }
+  fd_ = open(open_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+             0666);
+  for (int i = 0; i < kNumBlocks; i++) {
+    blocks_[i] = NULL;
+    written_[i] = NULL;
+  }
+  blocks_[0] = new char[kBlockSize];
+}
+
+BufferedWriter::~BufferedWriter() {
+  Close();
+  for (int i = 0; i < kNumBlocks; i++) {
+    delete[] blocks_[i];
+    delete[] written_[i];
+  }
+}
+
+void BufferedWriter::Write(const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size) {
+    if (pos_ == kBlockSize)
+      NextBlock();
+    size_t n = min(size, kBlockSize - pos_);
+    memcpy(blocks_[cur_] + pos_, p, n);
+    pos_ += n;
+    p += n;
+    size -= n;
+  }
+}
+
+BufferedWriter& BufferedWriter::operator<<(int v) {
+  char buf[16];
+  int n = snprintf(buf, sizeof(buf), "%d", v);
+  Write(buf, n);
+  return *this;
+}
+
+void BufferedWriter::NextBlock() {
+  if (cur_ + 1 == kNumBlocks) {
+    Flush();
+    return;
+  }
+  cur_++;
+  if (!blocks_[cur_])
+    blocks_[cur_] = new char[kBlockSize];
+  pos_ = 0;
+}
+
+static void WriteBlocks(int fd, struct iovec* iov, int cnt) {
+  while (cnt) {
+    ssize_t r = HANDLE_EINTR(writev(fd, iov, cnt));
+    if (r < 0)
+      PERROR("writev");
+    while (cnt && static_cast<size_t>(r) >= iov->iov_len) {
+      r -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + r;
+      iov->iov_len -= r;
+    }
+  }
+}
+
+void BufferedWriter::Flush() {
+  // |iov_| and |written_| are in use until the previous write finishes.
+  WaitForWrite();
+  int cnt = 0;
+  for (int i = 0; i <= cur_; i++) {
+    iov_[cnt].iov_base = blocks_[i];
+    iov_[cnt].iov_len = i == cur_ ? pos_ : kBlockSize;
+    if (iov_[cnt].iov_len)
+      cnt++;
+  }
+  cur_ = 0;
+  pos_ = 0;
+
+  if (!filename_.empty()) {
+    // Blocks are always filled before the next one is started, so the
+    // hash does not depend on how the content was written.
+    for (int i = 0; i < cnt; i++) {
+      string_view block(static_cast<const char*>(iov_[i].iov_base),
+                        iov_[i].iov_len);
+      hash_ = hash_ * 1099511628211ULL ^ hash<string_view>()(block);
+    }
+  }
+
+  if (!background_) {
+    WriteBlocks(fd_, iov_, cnt);
+    return;
+  }
+  // Fill the blocks of the previous write while these are written.
+  swap(blocks_, written_);
+  if (!blocks_[0])
+    blocks_[0] = new char[kBlockSize];
+  pending_write_ = std::async(std::launch::async,
+                              [this, cnt]() { WriteBlocks(fd_, iov_, cnt); });
+}
+
+void BufferedWriter::WaitForWrite() {
+  if (pending_write_.valid())
+    pending_write_.get();
+}
+
+void BufferedWriter::Close() {
+  if (fd_ < 0)
+    return;
+  Flush();
+  WaitForWrite();
+  if (close(fd_) != 0)
+    PERROR("close");
+  fd_ = -1;
+  if (!filename_.empty()) {
+    ReplaceIfChanged();
+    RemoveTmpFile(filename_ + ".tmp");
+  }
+}
+
+namespace {
+
+// What was last written into a kReplaceIfChanged file. The size and the
+// mtime tell whether the file was modified since.
+struct WrittenFile {
+  uint64_t hash;
+  int64_t size;
+  double mtime;
+};
+
+}  // namespace
+
+string BufferedWriter::GetHashFilename(const string& filename) {
+  return Dirname(filename).as_string() + "/." +
+         Basename(filename).as_string() + ".kati_hash";
+}
+
+bool BufferedWriter::Remove(const string& filename) {
+  unlink((filename + ".tmp").c_str());
+  unlink(GetHashFilename(filename).c_str());
+  return unlink(filename.c_str()) == 0;
+}
+
+void BufferedWriter::ReplaceIfChanged() {
+  const string tmp_filename = filename_ + ".tmp";
+  const string hash_filename = GetHashFilename(filename_);
+  struct stat st;
+  if (stat(filename_.c_str(), &st) == 0) {
+    WrittenFile last;
+    FILE* fp = fopen(hash_filename.c_str(), "rb");
+    if (fp) {
+      bool ok = fread(&last, sizeof(last), 1, fp) == 1;
+      fclose(fp);
+      if (ok && last.hash == hash_ && last.size == st.st_size &&
+          last.mtime == GetTimestampFromStat(st)) {
+        struct stat tmp_st;
+        if (stat(tmp_filename.c_str(), &tmp_st) == 0 &&
+            tmp_st.st_size == st.st_size) {
+          unlink(tmp_filename.c_str());
+          return;
+        }
+      }
+    }
+  }
+
+  if (rename(tmp_filename.c_str(), filename_.c_str()) != 0)
+    PERROR("rename(%s) failed", tmp_filename.c_str());
+  if (stat(filename_.c_str(), &st) != 0)
+    PERROR("stat(%s) failed", filename_.c_str());
+  WrittenFile written = {hash_, st.st_size, GetTimestampFromStat(st)};
+  FILE* fp = fopen(hash_filename.c_str(), "wb");
+  if (!fp)
+    PERROR("fopen(%s) failed", hash_filename.c_str());
+  ScopedFile sfp(fp);
+  size_t r = fwrite(&written, sizeof(written), 1, fp);
+  CHECK(r == 1);
+}
 
 void DumpInt(FILE* fp, int v) {
   size_t r = fwrite(&v, sizeof(v), 1, fp);
@@ -29,6 +255,15 @@ void DumpString(FILE* fp, StringPiece s) {
   CHECK(r == s.size());
 }
 
+void DumpInt(BufferedWriter* w, int v) {
+  w->Write(&v, sizeof(v));
+}
+
+void DumpString(BufferedWriter* w, StringPiece s) {
+  DumpInt(w, s.size());
+  w->Write(s.data(), s.size());
+}
+
 int LoadInt(FILE* fp) {
   int v;
   size_t r = fread(&v, sizeof(v), 1, fp);
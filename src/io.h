@@ -15,16 +15,92 @@
 #ifndef IO_H_
 #define IO_H_
 
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
+#include <future>
 #include <string>
 
 #include "string_piece.h"
 
 using namespace std;
 
+// An append-only file writer for large generated files. Output is copied
+// into fixed size blocks, and filled blocks are written together with one
+// writev(2), so small pieces cost no syscall and no stream formatting.
+class BufferedWriter {
+ public:
+  enum Mode {
+    kTruncate,
+    // Write into a temporary file, which replaces |filename| on Close()
+    // only if the content differs from what was last written there. An
+    // unchanged file keeps its mtime, so nothing which depends on it is
+    // redone. The temporary file is removed if kati exits before Close().
+    kReplaceIfChanged,
+  };
+
+  explicit BufferedWriter(const string& filename, Mode mode = kTruncate);
+  ~BufferedWriter();
+
+  bool is_open() const { return fd_ >= 0; }
+
+  // Writes filled blocks from another thread, so that producing the rest
+  // of the output overlaps with writing it.
+  void EnableBackgroundWrites() { background_ = true; }
+
+  void Write(const void* data, size_t size);
+
+  BufferedWriter& operator<<(StringPiece s) {
+    Write(s.data(), s.size());
+    return *this;
+  }
+  BufferedWriter& operator<<(char c) {
+    if (pos_ == kBlockSize)
+      NextBlock();
+    blocks_[cur_][pos_++] = c;
+    return *this;
+  }
+  BufferedWriter& operator<<(int v);
+
+  // Writes out everything and closes the file. Called by the destructor.
+  void Close();
+
+  // Removes |filename| and what kReplaceIfChanged keeps next to it.
+  // Returns false if |filename| did not exist.
+  static bool Remove(const string& filename);
+
+ private:
+  static constexpr size_t kBlockSize = 256 * 1024;
+  static constexpr int kNumBlocks = 16;
+
+  void NextBlock();
+  void Flush();
+  void WaitForWrite();
+  void ReplaceIfChanged();
+  static string GetHashFilename(const string& filename);
+
+  int fd_;
+  char* blocks_[kNumBlocks];
+  // The block being filled, and the size of its contents. The blocks before
+  // it are full.
+  int cur_;
+  size_t pos_;
+  struct iovec iov_[kNumBlocks];
+  // With background writes, the blocks being written by |pending_write_|.
+  char* written_[kNumBlocks];
+  bool background_;
+  future<void> pending_write_;
+  // With kReplaceIfChanged, the file to replace, and the hash of what has
+  // been flushed so far.
+  string filename_;
+  uint64_t hash_;
+};
+
 void DumpInt(FILE* fp, int v);
 void DumpString(FILE* fp, StringPiece s);
+void DumpInt(BufferedWriter* w, int v);
+void DumpString(BufferedWriter* w, StringPiece s);
 
 int LoadInt(FILE* fp);
 bool LoadString(FILE* fp, string* s);
@@ -0,0 +1,156 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// +build ignore
+
+#include "jobserver.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fileutil.h"
+#include "flags.h"
+#include "log.h"
+#include "stringprintf.h"
+#include "strutil.h"
+
+namespace {
+
+const char kToken = '+';
+
+bool IsValidFd(int fd) {
+  return fd >= 0 && fcntl(fd, F_GETFD) >= 0;
+}
+
+// The jobserver pipe is shared with other processes, so we cannot make it
+// non-blocking in place. Reopen it to get our own file description.
+int ReopenNonBlocking(int fd, int flags) {
+  int r;
+#if defined(__linux__)
+  string path = StringPrintf("/proc/self/fd/%d", fd);
+  r = open(path.c_str(), flags | O_NONBLOCK | O_CLOEXEC);
+  if (r >= 0)
+    return r;
+#endif
+  // This keeps the shared file description, so TryAcquire polls before
+  // reading. Another process may still win the race for the token.
+  r = dup(fd);
+  if (r < 0)
+    PERROR("dup failed");
+  if (fcntl(r, F_SETFD, FD_CLOEXEC) < 0)
+    PERROR("fcntl failed");
+  return r;
+}
+
+}  // namespace
+
+Jobserver::Jobserver(int read_fd, int write_fd)
+    : read_fd_(read_fd), write_fd_(write_fd) {}
+
+Jobserver::~Jobserver() {
+  while (!tokens_.empty())
+    Release();
+}
+
+Jobserver* Jobserver::Create() {
+  if (g_flags.has_num_jobs) {
+    if (!g_flags.jobserver_auth.empty()) {
+      WARN("*** warning: -j%d forced in submake: resetting jobserver mode.",
+           g_flags.num_jobs);
+    }
+    return g_flags.num_jobs > 1 ? Serve(g_flags.num_jobs) : NULL;
+  }
+  if (!g_flags.jobserver_auth.empty())
+    return Join(g_flags.jobserver_auth);
+  return NULL;
+}
+
+Jobserver* Jobserver::Join(const string& auth) {
+  if (HasPrefix(auth, "fifo:")) {
+    int fd = open(auth.c_str() + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      WARN("*** warning: cannot open jobserver %s: %s; using -j1",
+           auth.c_str() + 5, strerror(errno));
+      return NULL;
+    }
+    return new Jobserver(fd, fd);
+  }
+
+  int read_fd, write_fd;
+  if (sscanf(auth.c_str(), "%d,%d", &read_fd, &write_fd) != 2) {
+    WARN("*** warning: invalid jobserver auth: %s; using -j1", auth.c_str());
+    return NULL;
+  }
+  if (!IsValidFd(read_fd) || !IsValidFd(write_fd)) {
+    WARN("*** warning: jobserver unavailable: using -j1.  Add '+' to parent "
+         "make rule.");
+    return NULL;
+  }
+  return new Jobserver(ReopenNonBlocking(read_fd, O_RDONLY), write_fd);
+}
+
+Jobserver* Jobserver::Serve(int num_jobs) {
+  int pipefd[2];
+  if (pipe(pipefd) != 0)
+    PERROR("pipe failed");
+  // Sub-makes inherit both ends, so they stay open across exec.
+  for (int i = 1; i < num_jobs; i++) {
+    if (HANDLE_EINTR(write(pipefd[1], &kToken, 1)) != 1)
+      PERROR("write failed");
+  }
+
+  string makeflags;
+  if (const char* orig = getenv("MAKEFLAGS")) {
+    for (StringPiece tok : WordScanner(orig)) {
+      if (HasPrefix(tok, "-j") || HasPrefix(tok, "--jobserver-"))
+        continue;
+      tok.AppendToString(&makeflags);
+      makeflags += ' ';
+    }
+  }
+  makeflags += StringPrintf("-j%d --jobserver-auth=%d,%d", num_jobs,
+                            pipefd[0], pipefd[1]);
+  setenv("MAKEFLAGS", makeflags.c_str(), 1);
+
+  return new Jobserver(ReopenNonBlocking(pipefd[0], O_RDONLY), pipefd[1]);
+}
+
+bool Jobserver::TryAcquire() {
+  struct pollfd pfd;
+  pfd.fd = read_fd_;
+  pfd.events = POLLIN;
+  if (HANDLE_EINTR(poll(&pfd, 1, 0)) <= 0)
+    return false;
+  char c;
+  ssize_t r = HANDLE_EINTR(read(read_fd_, &c, 1));
+  if (r == 1) {
+    tokens_.push_back(c);
+    return true;
+  }
+  if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    PERROR("read from jobserver failed");
+  return false;
+}
+
+void Jobserver::Release() {
+  CHECK(!tokens_.empty());
+  // Give back the same token we took, as GNU make does.
+  char c = tokens_.back();
+  if (HANDLE_EINTR(write(write_fd_, &c, 1)) != 1)
+    PERROR("write to jobserver failed");
+  tokens_.pop_back();
+}
@@ -0,0 +1,52 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef JOBSERVER_H_
+#define JOBSERVER_H_
+
+#include <string>
+
+using namespace std;
+
+// A GNU make compatible jobserver. Every process sharing a jobserver owns
+// one implicit job slot and must take a token from the jobserver pipe for
+// each additional job it runs concurrently.
+class Jobserver {
+ public:
+  ~Jobserver();
+
+  // Joins the jobserver inherited through MAKEFLAGS. If there is none and
+  // -j was given, creates a new one so recipes running $(MAKE) share our
+  // job slots. Returns NULL if no jobserver should be used.
+  static Jobserver* Create();
+
+  // Takes a token without blocking. Returns false if none is available,
+  // in which case fd() becomes readable when one may be.
+  bool TryAcquire();
+  void Release();
+
+  int fd() const { return read_fd_; }
+
+ private:
+  Jobserver(int read_fd, int write_fd);
+
+  static Jobserver* Join(const string& auth);
+  static Jobserver* Serve(int num_jobs);
+
+  int read_fd_;
+  int write_fd_;
+  string tokens_;
+};
+
+#endif  // JOBSERVER_H_
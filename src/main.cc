@@ -35,6 +35,8 @@
 #include "ninja.h"
 #include "parser.h"
 #include "regen.h"
+#include "shell_cache.h"
+#include "shell_speculator.h"
 #include "stats.h"
 #include "stmt.h"
 #include "string_piece.h"
@@ -100,7 +102,7 @@ static void ReadBootstrapMakefile(const vector<Symbol>& targets,
 
 static void SetVar(StringPiece l,
                    VarOrigin origin,
-                   Frame* definition,
+                   std::shared_ptr<Frame> definition,
                    Loc loc) {
   size_t found = l.find('=');
   CHECK(found != string::npos);
@@ -267,10 +269,14 @@ static int Run(const vector<Symbol>& targets,
     ScopedFrame file_frame(ev.Enter(FrameType::PARSE, g_flags.makefile, Loc()));
     const Makefile& mk =
         MakefileCacheManager::Get().ReadMakefile(g_flags.makefile);
+    LoadShellCache();
+    SpeculateShellCommands(mk.stmts(), &ev);
     for (Stmt* stmt : mk.stmts()) {
       LOG("%s", stmt->DebugString().c_str());
       stmt->Eval(&ev);
     }
+    FinishSpeculativeShellCommands();
+    SaveShellCache();
   }
 
   for (ParseErrorStmt* err : GetParseErrors()) {
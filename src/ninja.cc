@@ -16,14 +16,21 @@
 
 #include "ninja.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#include <fstream>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
 #include <map>
-#include <ostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -47,6 +54,8 @@
 #include "var.h"
 #include "version.h"
 
+extern "C" char** environ;
+
 static size_t FindCommandLineFlag(StringPiece cmd, StringPiece name) {
   const size_t found = cmd.find(name);
   if (found == string::npos || found == 0)
@@ -169,18 +178,543 @@ bool GetDepfileFromCommand(string* cmd, string* out) {
   return true;
 }
 
+static bool IsNinjaShellSafe(char c) {
+  return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '+' ||
+         c == '-' || c == '.' || c == '/';
+}
+
+static bool IsWordSeparator(char c) {
+  return isspace(static_cast<unsigned char>(c)) ||
+         (c != '\0' && strchr("'\"=,:;()<>|&", c));
+}
+
+void ReplaceWithNinjaVar(const vector<StringPiece>& paths,
+                         StringPiece var,
+                         string* s) {
+  // ninja quotes each path in $in and $out unless it consists of these
+  // characters only, so only then the substitution keeps the command as
+  // it is.
+  string value;
+  for (StringPiece path : paths) {
+    if (path.empty())
+      return;
+    for (char c : path) {
+      if (!IsNinjaShellSafe(c))
+        return;
+    }
+    if (!value.empty())
+      value += ' ';
+    path.AppendToString(&value);
+  }
+  if (value.empty())
+    return;
+
+  string r;
+  size_t prev = 0;
+  for (size_t found = s->find(value); found != string::npos;
+       found = s->find(value, found + 1)) {
+    size_t end = found + value.size();
+    if (found < prev || (found > 0 && !IsWordSeparator((*s)[found - 1])) ||
+        (end < s->size() && !IsWordSeparator((*s)[end]))) {
+      continue;
+    }
+    r.append(*s, prev, found - prev);
+    r += '$';
+    var.AppendToString(&r);
+    prev = end;
+  }
+  if (prev == 0)
+    return;
+  r.append(*s, prev, string::npos);
+  s->swap(r);
+}
+
+static string EscapeNinja(const string& s) {
+  if (s.find_first_of("$: ") == string::npos)
+    return s;
+  string r;
+  for (char c : s) {
+    switch (c) {
+      case '$':
+      case ':':
+      case ' ':
+        r += '$';
+        [[fallthrough]];
+      default:
+        r += c;
+    }
+  }
+  return r;
+}
+
+// The same inputs appear in many build statements, so each symbol is
+// escaped only once. Most need no escaping and are returned as they are.
+// Not thread safe.
+class EscapedPaths {
+ public:
+  const string& Get(Symbol s) {
+    size_t i = static_cast<size_t>(s.val());
+    if (i >= escaped_.size())
+      escaped_.resize(i + 1);
+    const string*& r = escaped_[i];
+    if (!r) {
+      const string& str = s.str();
+      if (str.find_first_of("$: ") == string::npos) {
+        r = &str;
+      } else {
+        strs_.push_back(EscapeNinja(str));
+        r = &strs_.back();
+      }
+    }
+    return *r;
+  }
+
+ private:
+  // Indexed by Symbol::val(). Points into |strs_| or to the symbol's own
+  // string.
+  vector<const string*> escaped_;
+  deque<string> strs_;
+};
+
+// The bindings of a rule. Nodes whose rules are equal share one.
+struct NinjaRule {
+  string description;
+  // The depfile is written with "deps = gcc" if |has_depfile|, even if it
+  // is empty.
+  bool has_depfile = false;
+  string depfile;
+  // Whether the commands are written into an rspfile named $out.rsp.
+  bool use_rspfile = false;
+  string rspfile_content;
+  string command;
+  bool restat = false;
+
+  // Calls |fn| with the key and the value of each binding, in the order
+  // they are written.
+  template <typename Fn>
+  void ForEachBinding(Fn fn) const {
+    fn("description", description);
+    if (has_depfile) {
+      fn("depfile", depfile);
+      fn("deps", "gcc");
+    }
+    if (use_rspfile) {
+      fn("rspfile", "$out.rsp");
+      fn("rspfile_content", rspfile_content);
+    }
+    fn("command", command);
+    if (restat)
+      fn("restat", "1");
+  }
+
+};
+
+// A 128-bit FNV-1a hash. Unlike a size_t hash, it is wide enough for
+// contents to be told apart by their digests alone.
+class Digest {
+ public:
+  Digest& Add(StringPiece s) {
+    // The prime is 2^88 + 0x13b.
+    for (char c : s) {
+      h_ ^= static_cast<unsigned char>(c);
+      h_ = (h_ << 88) + h_ * 0x13b;
+    }
+    return *this;
+  }
+
+  // Adds |s| followed by a NUL, so that consecutive strings are not
+  // confused with their concatenation.
+  Digest& AddField(StringPiece s) {
+    Add(s);
+    return Add(StringPiece("", 1));
+  }
+
+  string ToHex() const {
+    return StringPrintf("%016llx%016llx",
+                        static_cast<unsigned long long>(h_ >> 64),
+                        static_cast<unsigned long long>(h_));
+  }
+
+  bool operator==(const Digest& d) const { return h_ == d.h_; }
+
+  size_t Hash() const { return static_cast<size_t>(h_); }
+
+ private:
+  unsigned __int128 h_ =
+      (static_cast<unsigned __int128>(0x6c62272e07bb0142ULL) << 64) |
+      0x62b821756295c58dULL;
+};
+
+struct DigestHash {
+  size_t operator()(const Digest& d) const { return d.Hash(); }
+};
+
+static Digest GetRuleDigest(const NinjaRule& rule) {
+  Digest d;
+  rule.ForEachBinding([&d](StringPiece key, StringPiece value) {
+    d.AddField(key).AddField(value);
+  });
+  return d;
+}
+
+// Writes the statements of a manifest in one of the formats ninja can
+// load. Each file of the manifest has its own emitter.
+class NinjaEmitter {
+ public:
+  NinjaEmitter(const string& filename, BufferedWriter::Mode mode)
+      : out_(filename, mode) {
+    if (!out_.is_open())
+      PERROR("open(%s) failed", filename.c_str());
+  }
+  virtual ~NinjaEmitter() = default;
+
+  void EnableBackgroundWrites() { out_.EnableBackgroundWrites(); }
+  void Close() { out_.Close(); }
+
+  virtual void Header() = 0;
+  virtual void Comment(StringPiece text) = 0;
+  virtual void Variable(StringPiece name, StringPiece value) = 0;
+  virtual void Pool(StringPiece name, int depth) = 0;
+  virtual void PhonyBuild(StringPiece output) = 0;
+  virtual void Rule(StringPiece name, const NinjaRule& rule) = 0;
+  // A phony |node| which does not get |always_build| is a phony output.
+  virtual void Build(const DepNode* node,
+                     StringPiece rule,
+                     StringPiece pool,
+                     bool always_build) = 0;
+  virtual void Subninjas(const vector<string>& filenames) = 0;
+  virtual void Default(const vector<Symbol>& targets) = 0;
+
+ protected:
+  BufferedWriter out_;
+};
+
+class TextNinjaEmitter : public NinjaEmitter {
+ public:
+  // |paths| may be shared by the emitters used from the same thread.
+  TextNinjaEmitter(const string& filename,
+                   BufferedWriter::Mode mode,
+                   EscapedPaths* paths)
+      : NinjaEmitter(filename, mode), paths_(paths) {}
+
+  void Header() override {
+    out_ << "# Generated by kati " << kGitVersion << "\n\n";
+  }
+
+  void Comment(StringPiece text) override { out_ << "# " << text << "\n"; }
+
+  void Variable(StringPiece name, StringPiece value) override {
+    out_ << name << " = " << value << "\n\n";
+  }
+
+  void Pool(StringPiece name, int depth) override {
+    out_ << "pool " << name << "\n"
+         << " depth = " << depth << "\n\n";
+  }
+
+  void PhonyBuild(StringPiece output) override {
+    out_ << "build " << output << ": phony\n\n";
+  }
+
+  void Rule(StringPiece name, const NinjaRule& rule) override {
+    out_ << "rule " << name << "\n";
+    rule.ForEachBinding([this](StringPiece key, StringPiece value) {
+      out_ << " " << key << " = " << value << "\n";
+    });
+  }
+
+  void Build(const DepNode* node,
+             StringPiece rule,
+             StringPiece pool,
+             bool always_build) override {
+    out_ << "build " << paths_->Get(node->output);
+    if (!node->implicit_outputs.empty()) {
+      out_ << " |";
+      for (Symbol output : node->implicit_outputs) {
+        out_ << " " << paths_->Get(output);
+      }
+    }
+    out_ << ": " << rule;
+    if (always_build) {
+      out_ << " _kati_always_build_";
+    }
+    for (auto const& d : node->deps) {
+      out_ << " " << paths_->Get(d.first);
+    }
+    if (!node->order_onlys.empty()) {
+      out_ << " ||";
+      for (auto const& d : node->order_onlys) {
+        out_ << " " << paths_->Get(d.first);
+      }
+    }
+    if (!node->validations.empty()) {
+      out_ << " |@";
+      for (auto const& d : node->validations) {
+        out_ << " " << paths_->Get(d.first);
+      }
+    }
+
+    out_ << "\n";
+
+    if (!node->symlink_outputs.empty()) {
+      out_ << " symlink_outputs =";
+      for (auto const& s : node->symlink_outputs) {
+        out_ << " " << paths_->Get(s);
+      }
+      out_ << "\n";
+    }
+
+    if (!pool.empty()) {
+      out_ << " pool = " << pool << "\n";
+    }
+    if (node->is_phony && !always_build) {
+      out_ << " phony_output = true\n";
+    }
+  }
+
+  void Subninjas(const vector<string>& filenames) override {
+    out_ << "\n";
+    for (const string& filename : filenames)
+      out_ << "subninja " << filename << "\n";
+  }
+
+  void Default(const vector<Symbol>& targets) override {
+    out_ << "\n"
+         << "default";
+    for (Symbol s : targets)
+      out_ << ' ' << paths_->Get(s);
+    out_ << '\n';
+  }
+
+ private:
+  EscapedPaths* paths_;
+};
+
+// Writes the manifest as a sequence of records, which a ninja built to
+// read it loads without tokenizing. A record is its kind followed by its
+// fields. Numbers are little-endian uint32s, and strings are a number of
+// bytes followed by the bytes.
+//
+// Paths and names are written once each as kString records, numbered
+// from zero in the order they appear, and referred to by their numbers.
+// Paths are not escaped. Binding values are written as build.ninja would
+// have them, so they may refer to variables like $out.
+//
+//   "kati-ninja" kFormatVersion kati_version
+//   kString      string
+//   kVariable    name value
+//   kPool        #name depth
+//   kRule        #name bindings
+//   kBuild       #rule num_outputs num_implicit_outputs num_inputs
+//                num_order_onlys num_validations num_symlink_outputs
+//                #path... bindings
+//   kSubninja    #filename
+//   kDefault     num_targets #target...
+//
+// where bindings are their number followed by a key and a value each.
+class BinaryNinjaEmitter : public NinjaEmitter {
+ public:
+  static constexpr int kFormatVersion = 2;
+  enum RecordKind {
+    kString = 1,
+    kVariable,
+    kPool,
+    kRule,
+    kBuild,
+    kSubninja,
+    kDefault,
+  };
+
+  BinaryNinjaEmitter(const string& filename, BufferedWriter::Mode mode)
+      : NinjaEmitter(filename, mode), num_strings_(0) {}
+
+  void Header() override {
+    WriteString("kati-ninja");
+    WriteInt(kFormatVersion);
+    WriteString(kGitVersion);
+  }
+
+  void Comment(StringPiece) override {}
+
+  void Variable(StringPiece name, StringPiece value) override {
+    WriteInt(kVariable);
+    WriteString(name);
+    WriteString(value);
+  }
+
+  void Pool(StringPiece name, int depth) override {
+    int id = GetNameId(name);
+    WriteInt(kPool);
+    WriteInt(id);
+    WriteInt(depth);
+  }
+
+  void PhonyBuild(StringPiece output) override {
+    int rule = GetNameId("phony");
+    int out = GetNameId(output);
+    WriteInt(kBuild);
+    WriteInt(rule);
+    const int counts[] = {1, 0, 0, 0, 0, 0};
+    for (int n : counts)
+      WriteInt(n);
+    WriteInt(out);
+    WriteInt(0);
+  }
+
+  void Rule(StringPiece name, const NinjaRule& rule) override {
+    int id = GetNameId(name);
+    vector<pair<StringPiece, StringPiece>> bindings;
+    rule.ForEachBinding([&bindings](StringPiece key, StringPiece value) {
+      bindings.emplace_back(key, value);
+    });
+    WriteInt(kRule);
+    WriteInt(id);
+    WriteBindings(bindings);
+  }
+
+  void Build(const DepNode* node,
+             StringPiece rule,
+             StringPiece pool,
+             bool always_build) override {
+    // Paths seen for the first time are written before the record.
+    ids_.clear();
+    ids_.push_back(GetPathId(node->output));
+    for (Symbol s : node->implicit_outputs)
+      ids_.push_back(GetPathId(s));
+    if (always_build)
+      ids_.push_back(GetNameId("_kati_always_build_"));
+    for (auto const& d : node->deps)
+      ids_.push_back(GetPathId(d.first));
+    for (auto const& d : node->order_onlys)
+      ids_.push_back(GetPathId(d.first));
+    for (auto const& d : node->validations)
+      ids_.push_back(GetPathId(d.first));
+    for (Symbol s : node->symlink_outputs)
+      ids_.push_back(GetPathId(s));
+    int rule_id = GetNameId(rule);
+
+    vector<pair<StringPiece, StringPiece>> bindings;
+    if (!pool.empty())
+      bindings.emplace_back("pool", pool);
+    if (node->is_phony && !always_build)
+      bindings.emplace_back("phony_output", "true");
+
+    WriteInt(kBuild);
+    WriteInt(rule_id);
+    WriteInt(1);
+    WriteInt(node->implicit_outputs.size());
+    WriteInt(node->deps.size() + always_build);
+    WriteInt(node->order_onlys.size());
+    WriteInt(node->validations.size());
+    WriteInt(node->symlink_outputs.size());
+    WriteIds();
+    WriteBindings(bindings);
+  }
+
+  void Subninjas(const vector<string>& filenames) override {
+    for (const string& filename : filenames) {
+      int id = GetNameId(filename);
+      WriteInt(kSubninja);
+      WriteInt(id);
+    }
+  }
+
+  void Default(const vector<Symbol>& targets) override {
+    ids_.clear();
+    for (Symbol s : targets)
+      ids_.push_back(GetPathId(s));
+    WriteInt(kDefault);
+    WriteInt(ids_.size());
+    WriteIds();
+  }
+
+ private:
+  void WriteInt(uint32_t v) {
+    const unsigned char bytes[] = {
+        static_cast<unsigned char>(v), static_cast<unsigned char>(v >> 8),
+        static_cast<unsigned char>(v >> 16),
+        static_cast<unsigned char>(v >> 24)};
+    out_.Write(bytes, sizeof(bytes));
+  }
+
+  void WriteString(StringPiece s) {
+    WriteInt(s.size());
+    out_.Write(s.data(), s.size());
+  }
+
+  void WriteIds() {
+    for (int id : ids_)
+      WriteInt(id);
+  }
+
+  int NewString(StringPiece s) {
+    WriteInt(kString);
+    WriteString(s);
+    return num_strings_++;
+  }
+
+  int GetPathId(Symbol s) {
+    size_t i = static_cast<size_t>(s.val());
+    if (i >= path_ids_.size())
+      path_ids_.resize(i + 1, -1);
+    if (path_ids_[i] < 0)
+      path_ids_[i] = NewString(s.str());
+    return path_ids_[i];
+  }
+
+  int GetNameId(StringPiece name) {
+    auto p = name_ids_.emplace(name.as_string(), 0);
+    if (p.second)
+      p.first->second = NewString(name);
+    return p.first->second;
+  }
+
+  void WriteBindings(const vector<pair<StringPiece, StringPiece>>& bindings) {
+    WriteInt(bindings.size());
+    for (auto const& b : bindings) {
+      WriteString(b.first);
+      WriteString(b.second);
+    }
+  }
+
+  int num_strings_;
+  // Indexed by Symbol::val().
+  vector<int> path_ids_;
+  unordered_map<string, int> name_ids_;
+  vector<int> ids_;
+};
+
+static NinjaEmitter* NewNinjaEmitter(const string& filename,
+                                     BufferedWriter::Mode mode,
+                                     EscapedPaths* paths) {
+  if (g_flags.ninja_binary_format)
+    return new BinaryNinjaEmitter(filename, mode);
+  return new TextNinjaEmitter(filename, mode, paths);
+}
+
 struct NinjaNode {
   const DepNode* node;
   vector<Command*> commands;
   int rule_id;
+  // .KATI_DEPFILE and .KATI_NINJA_POOL, evaluated while the node is
+  // populated so that emitting it does not need the evaluator.
+  bool has_depfile_var;
+  string depfile;
+  string pool;
+  // The node's rule and its name, which may be shared with other nodes.
+  NinjaRule rule;
+  string rule_name;
+  bool use_local_pool;
 };
 
 class NinjaGenerator {
  public:
+
   NinjaGenerator(Evaluator* ev, double start_time)
       : ce_(ev),
         ev_(ev),
         rule_id_(0),
+        stream_out_(NULL),
         start_time_(start_time),
         default_target_(NULL) {
     ev_->set_avoid_io(true);
@@ -202,8 +736,12 @@ class NinjaGenerator {
 
   void Generate(const vector<NamedDepNode>& nodes, const string& orig_args) {
     unlink(GetNinjaStampFilename().c_str());
-    PopulateNinjaNodes(nodes);
-    GenerateNinja();
+    // Streamed nodes are translated as they are evaluated, which needs the
+    // exports first.
+    if (!IsStreaming())
+      PopulateNinjaNodes(nodes);
+    EvalExports();
+    GenerateNinja(nodes);
     GenerateShell();
     GenerateStamp(orig_args);
   }
@@ -220,6 +758,12 @@ class NinjaGenerator {
   }
 
  private:
+  // Sharded and fragmented output need all the nodes before emitting any.
+  static bool IsStreaming() {
+    return g_flags.ninja_streaming && !g_flags.generate_empty_ninja &&
+           !g_flags.ninja_fragments && g_flags.ninja_shards <= 1;
+  }
+
   void PopulateNinjaNodes(const vector<NamedDepNode>& nodes) {
     ScopedTimeReporter tr("ninja gen (eval)");
     for (auto const& node : nodes) {
@@ -227,6 +771,41 @@ class NinjaGenerator {
     }
   }
 
+  // Evaluates the exported variables for env.sh, and computes how long a
+  // command ninja runs with them in the environment may be.
+  void EvalExports() {
+    size_t env_size = 0;
+    for (char** p = environ; *p; p++)
+      env_size += strlen(*p) + 1 + sizeof(char*);
+    for (const auto& p : ev_->exports()) {
+      if (p.second) {
+        const string val = ev_->EvalVar(p.first);
+        env_exports_ += "export '" + p.first.str() + "'='" + val + "'\n";
+        env_size += p.first.str().size() + val.size() + 2 + sizeof(char*);
+      } else {
+        env_exports_ += "unset '" + p.first.str() + "'\n";
+      }
+    }
+
+    // ninja runs each command as "/bin/sh -c <command>". The arguments and
+    // the environment must fit in ARG_MAX together. Leave some room for
+    // variables ninja or the user's shell may add.
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0)
+      arg_max = _POSIX_ARG_MAX;
+    const size_t kSlack = 4096;
+    if (static_cast<size_t>(arg_max) > env_size + kSlack)
+      max_command_size_ = arg_max - env_size - kSlack;
+    else
+      max_command_size_ = 0;
+#if defined(__linux__)
+    // Linux also limits the length of each argument to MAX_ARG_STRLEN,
+    // including the terminating NUL.
+    const size_t max_arg_strlen = 32 * sysconf(_SC_PAGESIZE);
+    max_command_size_ = min(max_command_size_, max_arg_strlen - 1);
+#endif
+  }
+
   void PopulateNinjaNode(DepNode* node) {
     if (done_.exists(node->output)) {
       return;
@@ -248,8 +827,17 @@ class NinjaGenerator {
     NinjaNode* nn = new NinjaNode;
     nn->node = node;
     ce_.Eval(node, &nn->commands);
+    nn->has_depfile_var = node->depfile_var;
+    if (node->depfile_var)
+      node->depfile_var->Eval(ev_, &nn->depfile);
+    if (node->ninja_pool_var)
+      node->ninja_pool_var->Eval(ev_, &nn->pool);
+    nn->rule_name = "phony";
+    nn->use_local_pool = false;
     nn->rule_id = nn->commands.empty() ? -1 : rule_id_++;
     nodes_.push_back(nn);
+    if (stream_out_ && nodes_.size() >= kStreamBatchSize)
+      EmitStreamedNodes();
 
     for (auto const& d : node->deps) {
       PopulateNinjaNode(d.second);
@@ -273,7 +861,18 @@ class NinjaGenerator {
     // stripped out.
     char prev_char = ' ';
     char quote = 0;
-    for (; *in; in++) {
+    for (;; in++) {
+      // Copy the run of characters which need no translation at once.
+      size_t n = strcspn(in, "#'\"`$\n\\");
+      if (n) {
+        cmd_buf->append(in, n);
+        in += n;
+        prev_backslash = false;
+        prev_char = in[-1];
+      }
+      if (!*in)
+        break;
+
       switch (*in) {
         case '#':
           if (quote == 0 && isspace(prev_char)) {
@@ -329,7 +928,7 @@ class NinjaGenerator {
       cmd_buf->resize(cmd_buf->size() - 1);
     }
 
-    while (true) {
+    while (cmd_buf->size() > orig_size) {
       char c = (*cmd_buf)[cmd_buf->size() - 1];
       if (!isspace(c) && c != ';')
         break;
@@ -412,6 +1011,11 @@ class NinjaGenerator {
     bool got_descritpion = false;
     bool use_gomacc = false;
     auto command_count = commands.size();
+    size_t size = 0;
+    for (const Command* c : commands)
+      size += c->cmd.size() + 8;
+    // One more for the space GetDepfile appends.
+    cmd_buf->reserve(size + 1);
     for (const Command* c : commands) {
       size_t cmd_begin = cmd_buf->size();
 
@@ -463,9 +1067,9 @@ class NinjaGenerator {
            !use_gomacc;
   }
 
-  bool GetDepfile(const DepNode* node, string* cmd_buf, string* depfile) {
-    if (node->depfile_var) {
-      node->depfile_var->Eval(ev_, depfile);
+  bool GetDepfile(const NinjaNode* nn, string* cmd_buf, string* depfile) {
+    if (nn->has_depfile_var) {
+      *depfile = nn->depfile;
       return true;
     }
     if (!g_flags.detect_depfiles)
@@ -477,139 +1081,353 @@ class NinjaGenerator {
     return result;
   }
 
-  void EmitDepfile(NinjaNode* nn, string* cmd_buf, std::ostream& out) {
-    const DepNode* node = nn->node;
-    string depfile;
-    if (!GetDepfile(node, cmd_buf, &depfile))
-      return;
-    out << " depfile = " << depfile << "\n";
-    out << " deps = gcc\n";
-  }
-
-  void EmitNode(NinjaNode* nn, std::ostream& out) {
+  // Computes the rule of |nn|. Thread safe.
+  void GenRule(NinjaNode* nn) {
     const DepNode* node = nn->node;
     const vector<Command*>& commands = nn->commands;
-
-    string rule_name = "phony";
-    bool use_local_pool = false;
-    if (IsSpecialTarget(node->output)) {
+    if (commands.empty())
       return;
+
+    const string& output = node->output.str();
+    string description = "build $out";
+    string cmd_buf;
+    nn->use_local_pool =
+        GenShellScript(output.c_str(), commands, &cmd_buf, &description);
+    // Lift the inputs and the output into $in and $out, so nodes whose
+    // commands differ only in them share a rule.
+    vector<StringPiece> ins, outs;
+    if (!node->is_phony || g_flags.use_ninja_phony_output) {
+      for (auto const& d : node->deps)
+        ins.push_back(d.first.str());
     }
-    if (g_flags.enable_debug) {
-      out << "# " << (node->loc.filename ? node->loc.filename : "(null)") << ':'
-          << node->loc.lineno << "\n";
-    }
-    if (!commands.empty()) {
-      rule_name = StringPrintf("rule%d", nn->rule_id);
-      out << "rule " << rule_name << "\n";
-
-      string description = "build $out";
-      string cmd_buf;
-      use_local_pool |= GenShellScript(node->output.c_str(), commands, &cmd_buf,
-                                       &description);
-      out << " description = " << description << "\n";
-      EmitDepfile(nn, &cmd_buf, out);
-
-      // It seems Linux is OK with ~130kB and Mac's limit is ~250kB.
-      // TODO: Find this number automatically.
-      if (cmd_buf.size() > 100 * 1000) {
-        out << " rspfile = $out.rsp\n";
-        out << " rspfile_content = " << cmd_buf << "\n";
-        out << " command = " << shell_ << " $out.rsp\n";
-      } else {
+    outs.push_back(output);
+    auto lift = [&ins, &outs](string* s) {
+      ReplaceWithNinjaVar(ins, "in", s);
+      ReplaceWithNinjaVar(outs, "out", s);
+    };
+    lift(&description);
+    NinjaRule& rule = nn->rule;
+    rule.description.swap(description);
+    rule.has_depfile = GetDepfile(nn, &cmd_buf, &rule.depfile);
+    if (rule.has_depfile)
+      lift(&rule.depfile);
+
+    // Use an rspfile only if the command would not fit in an exec. The
+    // quoted command gets at most twice as long as |cmd_buf|, so only
+    // commands near the limit are escaped twice.
+    const size_t overhead = shell_.size() + shell_flags_.size() + 4;
+    bool use_rspfile = cmd_buf.size() + overhead > max_command_size_;
+    string escaped;
+    if (!use_rspfile && cmd_buf.size() * 2 + overhead > max_command_size_) {
+      escaped = cmd_buf;
+      EscapeShell(&escaped);
+      use_rspfile = escaped.size() + overhead > max_command_size_;
+    }
+    if (use_rspfile) {
+      lift(&cmd_buf);
+      rule.use_rspfile = true;
+      rule.rspfile_content.swap(cmd_buf);
+      rule.command = shell_ + " $out.rsp";
+    } else {
+      if (escaped.empty()) {
         EscapeShell(&cmd_buf);
-        out << " command = " << shell_ << ' ' << shell_flags_ << " \""
-            << cmd_buf << "\"\n";
-      }
-      if (node->is_restat) {
-        out << " restat = 1\n";
+        escaped.swap(cmd_buf);
       }
+      lift(&escaped);
+      rule.command = shell_ + ' ' + shell_flags_ + " \"" + escaped + '"';
     }
-
-    EmitBuild(nn, rule_name, use_local_pool, out);
+    rule.restat = node->is_restat;
   }
 
-  string EscapeNinja(const string& s) const {
-    if (s.find_first_of("$: ") == string::npos)
-      return s;
-    string r;
-    for (char c : s) {
-      switch (c) {
-        case '$':
-        case ':':
-        case ' ':
-          r += '$';
-          [[fallthrough]];
-        default:
-          r += c;
-      }
+  // Names the rule of |nn|, and emits it if no node before had the same
+  // one. Only the digests of emitted rules are kept, so the commands are
+  // freed as the nodes are emitted.
+  void EmitRule(NinjaNode* nn, NinjaEmitter* out) {
+    if (nn->commands.empty())
+      return;
+    auto p = rule_names_.emplace(GetRuleDigest(nn->rule), string());
+    if (p.second) {
+      p.first->second = StringPrintf("rule%d", nn->rule_id);
+      out->Rule(p.first->second, nn->rule);
     }
-    return r;
+    nn->rule_name = p.first->second;
+    nn->rule = NinjaRule();
   }
 
-  string EscapeBuildTarget(Symbol s) const { return EscapeNinja(s.str()); }
-
-  void EmitBuild(NinjaNode* nn,
-                 const string& rule_name,
-                 bool use_local_pool,
-                 std::ostream& out) {
+  void EmitDebugLoc(const NinjaNode* nn, NinjaEmitter* out) {
     const DepNode* node = nn->node;
-    string target = EscapeBuildTarget(node->output);
-    out << "build " << target;
-    if (!node->implicit_outputs.empty()) {
-      out << " |";
-      for (Symbol output : node->implicit_outputs) {
-        out << " " << EscapeBuildTarget(output);
-      }
+    if (g_flags.enable_debug) {
+      out->Comment(StringPrintf(
+          "%s:%d", node->loc.filename ? node->loc.filename : "(null)",
+          node->loc.lineno));
     }
-    out << ": " << rule_name;
-    vector<Symbol> order_onlys;
-    if (node->is_phony && !g_flags.use_ninja_phony_output) {
-      out << " _kati_always_build_";
+  }
+
+  void EmitNode(NinjaNode* nn, NinjaEmitter* out) {
+    if (IsSpecialTarget(nn->node->output)) {
+      return;
     }
-    for (auto const& d : node->deps) {
-      out << " " << EscapeBuildTarget(d.first).c_str();
+    EmitDebugLoc(nn, out);
+    GenRule(nn);
+    EmitRule(nn, out);
+    EmitBuild(nn, out);
+  }
+
+  // Hands the nodes populated so far to a thread which emits them and
+  // frees their commands, while the next batch is evaluated. At most two
+  // batches are held at once.
+  void EmitStreamedNodes() {
+    WaitForStreamedNodes();
+    pending_emit_ = std::async(
+        std::launch::async, [this, batch = std::move(nodes_)]() {
+          for (NinjaNode* nn : batch) {
+            EmitNode(nn, stream_out_);
+            for (Command* c : nn->commands)
+              delete c;
+            delete nn;
+          }
+        });
+    nodes_.clear();
+  }
+
+  void WaitForStreamedNodes() {
+    if (pending_emit_.valid())
+      pending_emit_.get();
+  }
+
+  static string GetShardFilename(int i) {
+    return GetFilename(StringPrintf("build%%s.%d.ninja", i).c_str());
+  }
+
+  // Emits the rules into |out| and the build statements into
+  // --ninja_shards subninja files, which are written in parallel.
+  void EmitShards(NinjaEmitter* out) {
+    const int num_shards = g_flags.ninja_shards;
+    vector<vector<NinjaNode*>> shards(num_shards);
+    for (NinjaNode* nn : nodes_) {
+      if (IsSpecialTarget(nn->node->output))
+        continue;
+      size_t h = hash<StringPiece>()(nn->node->output.str());
+      shards[h % num_shards].push_back(nn);
     }
-    if (!node->order_onlys.empty()) {
-      out << " ||";
-      for (auto const& d : node->order_onlys) {
-        out << " " << EscapeBuildTarget(d.first).c_str();
-      }
+
+    // Shards are taken in order by at most one thread per CPU.
+    auto run_shards = [num_shards](const function<void(int)>& fn) {
+      atomic<int> next_shard(0);
+      auto worker = [&next_shard, &fn, num_shards]() {
+        for (int i = next_shard++; i < num_shards; i = next_shard++)
+          fn(i);
+      };
+      const int num_threads = min(max(g_flags.num_cpus, 1), num_shards);
+      vector<future<void>> futures;
+      for (int i = 0; i < num_threads; i++)
+        futures.push_back(std::async(std::launch::async, worker));
+      for (future<void>& f : futures)
+        f.get();
+    };
+
+    run_shards([this, &shards](int i) {
+      for (NinjaNode* nn : shards[i])
+        GenRule(nn);
+    });
+    // Rules are named in the order of the nodes, as without shards.
+    for (NinjaNode* nn : nodes_) {
+      if (!IsSpecialTarget(nn->node->output))
+        EmitRule(nn, out);
     }
-    if (!node->validations.empty()) {
-      out << " |@";
-      for (auto const& d : node->validations) {
-        out << " " << EscapeBuildTarget(d.first).c_str();
+    run_shards([this, &shards](int i) {
+      EscapedPaths escaped_paths;
+      unique_ptr<NinjaEmitter> shard(
+          NewNinjaEmitter(GetShardFilename(i),
+                          BufferedWriter::kReplaceIfChanged, &escaped_paths));
+      shard->Header();
+      for (NinjaNode* nn : shards[i]) {
+        EmitDebugLoc(nn, shard.get());
+        EmitBuild(nn, shard.get());
       }
+    });
+
+    vector<string> filenames;
+    for (int i = 0; i < num_shards; i++)
+      filenames.push_back(GetShardFilename(i));
+    out->Subninjas(filenames);
+  }
+
+  // Removes the shards which a previous run with more --ninja_shards left
+  // behind. They are numbered from 0, so the first missing one is the end.
+  static void RemoveStaleShards() {
+    int num_shards = 0;
+    if (!g_flags.ninja_fragments && !g_flags.generate_empty_ninja &&
+        g_flags.ninja_shards > 1) {
+      num_shards = g_flags.ninja_shards;
     }
+    for (int i = num_shards;; i++) {
+      if (!BufferedWriter::Remove(GetShardFilename(i)))
+        break;
+    }
+  }
 
-    out << "\n";
+  static string GetFragmentDir() { return GetFilename("kati_fragments%s"); }
+
+  // Everything other than the nodes themselves which their rules and build
+  // statements depend on.
+  string GetFragmentKeyPrefix() const {
+    return StringPrintf(
+        "%s\n%s\n%s\n%zu\n%d%d%d%d%d%d\n%d\n%s\n%s\n", kGitVersion,
+        shell_.c_str(), shell_flags_.c_str(), max_command_size_, use_goma_,
+        g_flags.detect_android_echo, g_flags.detect_depfiles,
+        g_flags.enable_debug, g_flags.use_ninja_phony_output,
+        g_flags.ninja_binary_format, g_flags.remote_num_jobs,
+        g_flags.default_pool ? g_flags.default_pool : "", gomacc_.c_str());
+  }
 
-    if (!node->symlink_outputs.empty()) {
-      out << " symlink_outputs =";
-      for (auto const& s : node->symlink_outputs) {
-        out << " " << EscapeBuildTarget(s);
-      }
-      out << "\n";
+  static void AddToFragmentDigest(const NinjaNode* nn, Digest* d) {
+    const DepNode* node = nn->node;
+    auto add_symbols = [d](const vector<Symbol>& syms) {
+      d->AddField(StringPrintf("%zu", syms.size()));
+      for (Symbol s : syms)
+        d->AddField(s.str());
+    };
+    auto add_nodes = [d](const vector<NamedDepNode>& deps) {
+      d->AddField(StringPrintf("%zu", deps.size()));
+      for (auto const& p : deps)
+        d->AddField(p.first.str());
+    };
+    d->AddField(node->output.str());
+    d->AddField(node->loc.filename ? node->loc.filename : "(null)");
+    d->AddField(StringPrintf("%d:%d%d%d", node->loc.lineno, node->is_phony,
+                             node->is_restat, nn->has_depfile_var));
+    add_symbols(node->implicit_outputs);
+    add_symbols(node->symlink_outputs);
+    add_nodes(node->deps);
+    add_nodes(node->order_onlys);
+    add_nodes(node->validations);
+    d->AddField(nn->depfile);
+    d->AddField(nn->pool);
+    d->AddField(StringPrintf("%zu", nn->commands.size()));
+    for (const Command* c : nn->commands) {
+      d->AddField(StringPrintf("%d%d", c->echo, c->ignore_error));
+      d->AddField(c->cmd);
     }
+  }
+
+  // The variable each fragment starts with, set to the digest it was
+  // generated from.
+  static constexpr const char* kFragmentDigestVar = "kati_fragment";
 
-    string pool;
-    if (node->ninja_pool_var) {
-      node->ninja_pool_var->Eval(ev_, &pool);
+  // Whether |filename| is the fragment generated for |digest|, which its
+  // header records. Files are named by their digests, so this only fails
+  // for files which were not written by kati.
+  static bool IsFragmentOf(const string& filename, const string& digest) {
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+      return false;
+    ScopedFile sfp(fp);
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    return StringPiece(buf, n).find(digest) != string::npos;
+  }
+
+  // Writes a subninja file with the rules and the build statements of
+  // |nns|. The file is renamed into place only once it is complete.
+  void EmitFragment(const vector<NinjaNode*>& nns,
+                    const string& filename,
+                    const string& digest) {
+    const string tmp_filename = filename + ".tmp";
+    unique_ptr<NinjaEmitter> out(NewNinjaEmitter(
+        tmp_filename, BufferedWriter::kTruncate, &escaped_paths_));
+    out->Header();
+    out->Variable(kFragmentDigestVar, digest);
+    // Each subninja file has its own scope of rules, so name them from
+    // zero for the file's content to depend only on its nodes.
+    rule_names_.clear();
+    int rule_id = 0;
+    for (NinjaNode* nn : nns) {
+      if (!nn->commands.empty())
+        nn->rule_id = rule_id++;
+      EmitNode(nn, out.get());
     }
+    out->Close();
+    if (rename(tmp_filename.c_str(), filename.c_str()) != 0)
+      PERROR("rename(%s) failed", tmp_filename.c_str());
+  }
+
+  // Emits the nodes of each makefile into a subninja file named by a
+  // digest of everything it is generated from. The recipes are evaluated
+  // for the digest, as they depend on variables which may be set anywhere.
+  // Files which already exist for the same digest are reused without
+  // translating their recipes into rules, so only the makefiles whose
+  // rules changed are translated and written again.
+  void EmitFragments(NinjaEmitter* out) {
+    vector<vector<NinjaNode*>> fragments;
+    unordered_map<StringPiece, size_t> fragment_index;
+    for (NinjaNode* nn : nodes_) {
+      const DepNode* node = nn->node;
+      if (IsSpecialTarget(node->output))
+        continue;
+      // EmitBuild is not called for reused fragments.
+      if (node->is_default_target)
+        default_target_ = node;
+      StringPiece filename(node->loc.filename ? node->loc.filename : "");
+      auto p = fragment_index.emplace(filename, fragments.size());
+      if (p.second)
+        fragments.emplace_back();
+      fragments[p.first->second].push_back(nn);
+    }
+
+    const string dir = GetFragmentDir();
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+      PERROR("mkdir(%s) failed", dir.c_str());
+    const string prefix = GetFragmentKeyPrefix();
+    unordered_set<string> used;
+    vector<string> filenames;
+    int num_reused = 0;
+    for (const vector<NinjaNode*>& nns : fragments) {
+      Digest d;
+      d.AddField(prefix);
+      for (const NinjaNode* nn : nns)
+        AddToFragmentDigest(nn, &d);
+      const string digest = d.ToHex();
+      string basename = digest + ".ninja";
+      const string filename = dir + '/' + basename;
+      if (IsFragmentOf(filename, digest))
+        num_reused++;
+      else
+        EmitFragment(nns, filename, digest);
+      filenames.push_back(filename);
+      used.insert(move(basename));
+    }
+    out->Subninjas(filenames);
+    LOG_STAT("%d/%zu ninja fragments reused", num_reused, fragments.size());
+
+    // Remove the fragments of the makefiles' previous contents.
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+      PERROR("opendir(%s) failed", dir.c_str());
+    while (struct dirent* ent = readdir(d)) {
+      if (ent->d_name[0] != '.' && !used.count(ent->d_name))
+        unlink((dir + '/' + ent->d_name).c_str());
+    }
+    closedir(d);
+  }
 
-    if (pool != "") {
-      if (pool != "none") {
-        out << " pool = " << pool << "\n";
+  // Emits the build statement of |nn|. Thread safe as long as each thread
+  // uses its own |out|.
+  void EmitBuild(NinjaNode* nn, NinjaEmitter* out) {
+    const string& rule_name = nn->rule_name;
+    const DepNode* node = nn->node;
+    StringPiece pool;
+    if (nn->pool != "") {
+      if (nn->pool != "none") {
+        pool = nn->pool;
       }
     } else if (g_flags.default_pool && rule_name != "phony") {
-      out << " pool = " << g_flags.default_pool << "\n";
-    } else if (use_local_pool) {
-      out << " pool = local_pool\n";
-    }
-    if (node->is_phony && g_flags.use_ninja_phony_output) {
-      out << " phony_output = true\n";
+      pool = g_flags.default_pool;
+    } else if (nn->use_local_pool) {
+      pool = "local_pool";
     }
+    out->Build(node, rule_name, pool,
+               node->is_phony && !g_flags.use_ninja_phony_output);
     if (node->is_default_target) {
       unique_lock<mutex> lock(mu_);
       default_target_ = node;
@@ -618,40 +1436,55 @@ class NinjaGenerator {
 
   static string GetEnvScriptFilename() { return GetFilename("env%s.sh"); }
 
-  void GenerateNinja() {
+  void GenerateNinja(const vector<NamedDepNode>& nodes) {
     ScopedTimeReporter tr("ninja gen (emit)");
-    std::ofstream out(GetNinjaFilename(), std::ios::binary);
-    if (!out)
-      PERROR("fopen(build.ninja) failed");
+    // A streamed build.ninja is written while the commands are evaluated.
+    // It replaces the previous one only once evaluation succeeded.
+    unique_ptr<NinjaEmitter> out(NewNinjaEmitter(
+        GetNinjaFilename(), BufferedWriter::kReplaceIfChanged,
+        &escaped_paths_));
+    if (IsStreaming())
+      out->EnableBackgroundWrites();
 
-    out << "# Generated by kati " << kGitVersion << "\n\n";
+    out->Header();
 
     if (!used_envs_.empty()) {
-      out << "# Environment variables used:\n";
+      out->Comment("Environment variables used:");
       for (const auto& p : used_envs_) {
-        out << "# " << p.first << "=" << p.second << '\n';
+        out->Comment(p.first + "=" + p.second);
       }
-      out << '\n';
     }
 
     if (!g_flags.no_ninja_prelude) {
       if (g_flags.ninja_dir) {
-        out << "builddir = " << g_flags.ninja_dir << "\n\n";
+        out->Variable("builddir", g_flags.ninja_dir);
       }
 
-      out << "pool local_pool\n"
-          << " depth = " << g_flags.num_jobs << "\n\n";
+      out->Pool("local_pool", g_flags.num_jobs);
 
       if (!g_flags.use_ninja_phony_output) {
-        out << "build _kati_always_build_: phony\n\n";
+        out->PhonyBuild("_kati_always_build_");
       }
     }
 
-    if (!g_flags.generate_empty_ninja) {
-      for (const auto& node : nodes_) {
-        EmitNode(node, out);
+    if (IsStreaming()) {
+      stream_out_ = out.get();
+      PopulateNinjaNodes(nodes);
+      EmitStreamedNodes();
+      WaitForStreamedNodes();
+      stream_out_ = NULL;
+    } else if (!g_flags.generate_empty_ninja) {
+      if (g_flags.ninja_fragments) {
+        EmitFragments(out.get());
+      } else if (g_flags.ninja_shards > 1) {
+        EmitShards(out.get());
+      } else {
+        for (const auto& node : nodes_) {
+          EmitNode(node, out.get());
+        }
       }
     }
+    RemoveStaleShards();
 
     SymbolSet used_env_vars(Vars::used_env_vars());
     // PATH changes $(shell).
@@ -661,121 +1494,111 @@ class NinjaGenerator {
       used_envs_.emplace(e.str(), val.as_string());
     }
 
-    string default_targets;
+    vector<Symbol> default_targets;
     if (g_flags.targets.empty() || g_flags.gen_all_targets) {
       CHECK(default_target_);
-      default_targets = EscapeBuildTarget(default_target_->output);
+      default_targets.push_back(default_target_->output);
     } else {
-      for (Symbol s : g_flags.targets) {
-        if (!default_targets.empty())
-          default_targets += ' ';
-        default_targets += EscapeBuildTarget(s);
-      }
+      default_targets = g_flags.targets;
     }
     if (!g_flags.generate_empty_ninja) {
-      out << "\n"
-          << "default " << default_targets << '\n';
+      out->Default(default_targets);
     }
   }
 
   void GenerateShell() {
-    FILE* fp = fopen(GetEnvScriptFilename().c_str(), "wb");
-    if (fp == NULL)
-      PERROR("fopen(env.sh) failed");
+    BufferedWriter out(GetEnvScriptFilename(),
+                       BufferedWriter::kReplaceIfChanged);
+    if (!out.is_open())
+      PERROR("open(env.sh) failed");
 
-    fprintf(fp, "#!/bin/sh\n");
-    fprintf(fp, "# Generated by kati %s\n", kGitVersion);
-    fprintf(fp, "\n");
+    out << "#!/bin/sh\n";
+    out << "# Generated by kati " << kGitVersion << "\n";
+    out << "\n";
 
-    for (const auto& p : ev_->exports()) {
-      if (p.second) {
-        const string val = ev_->EvalVar(p.first);
-        fprintf(fp, "export '%s'='%s'\n", p.first.c_str(), val.c_str());
-      } else {
-        fprintf(fp, "unset '%s'\n", p.first.c_str());
-      }
-    }
+    out << env_exports_;
 
-    fclose(fp);
+    out.Close();
 
-    fp = fopen(GetNinjaShellScriptFilename().c_str(), "wb");
-    if (fp == NULL)
-      PERROR("fopen(ninja.sh) failed");
+    BufferedWriter sh(GetNinjaShellScriptFilename(),
+                      BufferedWriter::kReplaceIfChanged);
+    if (!sh.is_open())
+      PERROR("open(ninja.sh) failed");
 
-    fprintf(fp, "#!/bin/sh\n");
-    fprintf(fp, "# Generated by kati %s\n", kGitVersion);
-    fprintf(fp, "\n");
+    sh << "#!/bin/sh\n";
+    sh << "# Generated by kati " << kGitVersion << "\n";
+    sh << "\n";
 
-    fprintf(fp, ". %s\n", GetEnvScriptFilename().c_str());
+    sh << ". " << GetEnvScriptFilename() << "\n";
 
-    fprintf(fp, "exec ninja -f %s ", GetNinjaFilename().c_str());
+    sh << "exec " << (g_flags.ninja_reader ? g_flags.ninja_reader : "ninja")
+       << " -f " << GetNinjaFilename() << " ";
     if (g_flags.remote_num_jobs > 0) {
-      fprintf(fp, "-j%d ", g_flags.remote_num_jobs);
+      sh << "-j" << g_flags.remote_num_jobs << " ";
     } else if (g_flags.goma_dir) {
-      fprintf(fp, "-j500 ");
+      sh << "-j500 ";
     }
-    fprintf(fp, "\"$@\"\n");
+    sh << "\"$@\"\n";
 
-    fclose(fp);
+    sh.Close();
 
     if (chmod(GetNinjaShellScriptFilename().c_str(), 0755) != 0)
       PERROR("chmod ninja.sh failed");
   }
 
   void GenerateStamp(const string& orig_args) {
-    FILE* fp = fopen(GetStampTempFilename().c_str(), "wb");
-    CHECK(fp);
+    BufferedWriter out(GetStampTempFilename());
+    CHECK(out.is_open());
 
-    size_t r = fwrite(&start_time_, sizeof(start_time_), 1, fp);
-    CHECK(r == 1);
+    out.Write(&start_time_, sizeof(start_time_));
+    DumpInt(&out, kNinjaStampVersion);
 
     unordered_set<string> makefiles;
     MakefileCacheManager::Get().GetAllFilenames(&makefiles);
-    DumpInt(fp, makefiles.size() + 1);
-    DumpString(fp, kati_binary_);
+    DumpInt(&out, makefiles.size() + 1);
+    DumpString(&out, kati_binary_);
     for (const string& makefile : makefiles) {
-      DumpString(fp, makefile);
+      DumpString(&out, makefile);
     }
 
-    DumpInt(fp, Evaluator::used_undefined_vars().size());
+    DumpInt(&out, Evaluator::used_undefined_vars().size());
     for (Symbol v : Evaluator::used_undefined_vars()) {
-      DumpString(fp, v.str());
+      DumpString(&out, v.str());
     }
-    DumpInt(fp, used_envs_.size());
+    DumpInt(&out, used_envs_.size());
     for (const auto& p : used_envs_) {
-      DumpString(fp, p.first);
-      DumpString(fp, p.second);
+      DumpString(&out, p.first);
+      DumpString(&out, p.second);
     }
 
-    const unordered_map<string, vector<string>*>& globs = GetAllGlobCache();
-    DumpInt(fp, globs.size());
+    unordered_map<string, vector<string>*> globs;
+    GetAllGlobCache(&globs);
+    DumpInt(&out, globs.size());
     for (const auto& p : globs) {
-      DumpString(fp, p.first);
+      DumpString(&out, p.first);
       const vector<string>& files = *p.second;
-#if 0
-      unordered_set<string> dirs;
-      GetReadDirs(p.first, files, &dirs);
-      DumpInt(fp, dirs.size());
+      vector<string> dirs;
+      GetGlobReadDirs(p.first, &dirs);
+      DumpInt(&out, dirs.size());
       for (const string& dir : dirs) {
-        DumpString(fp, dir);
+        DumpString(&out, dir);
       }
-#endif
-      DumpInt(fp, files.size());
+      DumpInt(&out, files.size());
       for (const string& file : files) {
-        DumpString(fp, file);
+        DumpString(&out, file);
       }
     }
 
     const vector<CommandResult*>& crs = GetShellCommandResults();
-    DumpInt(fp, crs.size());
+    DumpInt(&out, crs.size());
     for (CommandResult* cr : crs) {
-      DumpInt(fp, static_cast<int>(cr->op));
-      DumpString(fp, cr->shell);
-      DumpString(fp, cr->shellflag);
-      DumpString(fp, cr->cmd);
-      DumpString(fp, cr->result);
-      DumpString(fp, cr->loc.filename);
-      DumpInt(fp, cr->loc.lineno);
+      DumpInt(&out, static_cast<int>(cr->op));
+      DumpString(&out, cr->shell);
+      DumpString(&out, cr->shellflag);
+      DumpString(&out, cr->cmd);
+      DumpString(&out, cr->result);
+      DumpString(&out, cr->loc.filename);
+      DumpInt(&out, cr->loc.lineno);
 
       if (cr->op == CommandOp::FIND) {
         vector<string> missing_dirs;
@@ -784,26 +1607,26 @@ class NinjaGenerator {
           if (!Exists(d))
             missing_dirs.push_back(d);
         }
-        DumpInt(fp, missing_dirs.size());
+        DumpInt(&out, missing_dirs.size());
         for (const string& d : missing_dirs) {
-          DumpString(fp, d);
+          DumpString(&out, d);
         }
 
-        DumpInt(fp, cr->find->found_files->size());
+        DumpInt(&out, cr->find->found_files->size());
         for (StringPiece s : *cr->find->found_files) {
-          DumpString(fp, ConcatDir(cr->find->chdir, s));
+          DumpString(&out, ConcatDir(cr->find->chdir, s));
         }
 
-        DumpInt(fp, cr->find->read_dirs->size());
+        DumpInt(&out, cr->find->read_dirs->size());
         for (StringPiece s : *cr->find->read_dirs) {
-          DumpString(fp, ConcatDir(cr->find->chdir, s));
+          DumpString(&out, ConcatDir(cr->find->chdir, s));
         }
       }
     }
 
-    DumpString(fp, orig_args);
+    DumpString(&out, orig_args);
 
-    fclose(fp);
+    out.Close();
 
     rename(GetStampTempFilename().c_str(), GetNinjaStampFilename().c_str());
   }
@@ -812,6 +1635,19 @@ class NinjaGenerator {
   Evaluator* ev_;
   SymbolSet done_;
   int rule_id_;
+  // While streaming, nodes are emitted into it in batches of this size.
+  // Only the thread running |pending_emit_| uses it, and the rules and the
+  // paths emitted so far, until the batch is done.
+  static constexpr size_t kStreamBatchSize = 1024;
+  NinjaEmitter* stream_out_;
+  future<void> pending_emit_;
+  // From the digest of each emitted rule to its name.
+  unordered_map<Digest, string, DigestHash> rule_names_;
+  // The lines of env.sh which set up the exported variables.
+  string env_exports_;
+  // Longer commands are written into rspfiles.
+  size_t max_command_size_;
+  EscapedPaths escaped_paths_;
   bool use_goma_;
   string gomacc_;
   string shell_;
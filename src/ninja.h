@@ -36,8 +36,16 @@ string GetNinjaFilename();
 string GetNinjaShellScriptFilename();
 string GetNinjaStampFilename();
 
+// Written after the generation time at the start of the stamp file, and
+// bumped whenever its layout changes. A stamp of another version always
+// causes regeneration, even if the kati binary itself is ignored.
+const int kNinjaStampVersion = 2;
+
 // Exposed only for test.
 bool GetDepfileFromCommand(string* cmd, string* out);
 size_t GetGomaccPosForAndroidCompileCommand(StringPiece cmdline);
+void ReplaceWithNinjaVar(const vector<StringPiece>& paths,
+                         StringPiece var,
+                         string* s);
 
 #endif  // NINJA_H_
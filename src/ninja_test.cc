@@ -77,11 +77,34 @@ static void TestGetGomaccPosForAndroidCompileCommand() {
   ASSERT_EQ(GetGomaccPosForAndroidCompileCommand("echo foo"), string::npos);
 }
 
+static string ReplaceVar(vector<StringPiece> paths, string cmd) {
+  ReplaceWithNinjaVar(paths, "in", &cmd);
+  return cmd;
+}
+
+static void TestReplaceWithNinjaVar() {
+  ASSERT_EQ(ReplaceVar({"out/a.o"}, "cc -c a.c -o out/a.o"),
+            "cc -c a.c -o $in");
+  ASSERT_EQ(ReplaceVar({"a"}, "touch a; echo 'a' >a.log"),
+            "touch $in; echo '$in' >a.log");
+  ASSERT_EQ(ReplaceVar({"a.o"}, "cp b/a.o xa.o a.oo $$a.o"),
+            "cp b/a.o xa.o a.oo $$a.o");
+  ASSERT_EQ(ReplaceVar({"a.c", "b.c"}, "cc a.c b.c a.c"), "cc $in a.c");
+  ASSERT_EQ(ReplaceVar({"a b"}, "touch a b"), "touch a b");
+  ASSERT_EQ(ReplaceVar({"a$b"}, "touch a$b"), "touch a$b");
+  ASSERT_EQ(ReplaceVar({}, "touch a"), "touch a");
+  ASSERT_EQ(ReplaceVar({"\xc3\xa9.o"}, "touch \xc3\xa9.o"),
+            "touch \xc3\xa9.o");
+  ASSERT_EQ(ReplaceVar({"a"}, "touch \xa0" "a"), "touch \xa0" "a");
+  ASSERT_EQ(ReplaceVar({"a"}, string("touch\0a", 7)), string("touch\0a", 7));
+}
+
 }  // namespace
 
 int main() {
   g_log_no_exit = true;
   TestGetDepfile();
   TestGetGomaccPosForAndroidCompileCommand();
+  TestReplaceWithNinjaVar();
   assert(!g_failed);
 }
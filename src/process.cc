@@ -0,0 +1,472 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// +build ignore
+
+#include "process.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#else
+#include <poll.h>
+#endif
+
+#include <algorithm>
+#include <mutex>
+
+#include "log.h"
+#include "strutil.h"
+#include "timeutil.h"
+
+extern "C" char** environ;
+
+namespace {
+
+// Only these shells are known to run a simple command as a plain exec.
+bool CanBypassShell(const string& shell, const string& shellflag) {
+  if (shellflag != "-c" || shell[0] != '/' ||
+      shell.find_first_of(" $") != string::npos) {
+    return false;
+  }
+  StringPiece name = Basename(shell);
+  return name == "sh" || name == "bash" || name == "dash";
+}
+
+// Looks |name| up in $PATH the way execvp would. Lookups are cached until
+// $PATH changes.
+bool FindExecutable(StringPiece name, string* path) {
+  static mutex mu;
+  static string cached_path_env;
+  static unordered_map<string, string> cache;
+
+  auto is_executable = [](const string& f) {
+    struct stat st;
+    return stat(f.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+           access(f.c_str(), X_OK) == 0;
+  };
+
+  if (name.find('/') != string::npos) {
+    *path = name.as_string();
+    return is_executable(*path);
+  }
+
+  const char* path_env = getenv("PATH");
+  if (!path_env)
+    return false;
+  unique_lock<mutex> lock(mu);
+  if (cached_path_env != path_env) {
+    cached_path_env = path_env;
+    cache.clear();
+  }
+  auto p = cache.emplace(name.as_string(), "");
+  if (p.second) {
+    StringPiece dirs(path_env);
+    while (true) {
+      size_t found = dirs.find(':');
+      StringPiece dir = dirs.substr(0, found);
+      string f = ConcatDir(dir.empty() ? "." : dir, name);
+      if (is_executable(f)) {
+        p.first->second = f;
+        break;
+      }
+      if (found == string::npos)
+        break;
+      dirs = dirs.substr(found + 1);
+    }
+  }
+  *path = p.first->second;
+  return !path->empty();
+}
+
+// Fills |argv| with the program to run for |cmd|. Returns true if it
+// runs |cmd| directly, in which case |path| is the full path of the
+// program. argv[0] is left as written so the program reports errors the
+// same way as when it is run by the shell.
+bool GetArgv(const string& shell,
+             const string& shellflag,
+             const string& cmd,
+             bool allow_direct,
+             string* path,
+             vector<string>* argv) {
+  vector<StringPiece> args;
+  // Let the shell report missing commands in its usual way.
+  if (allow_direct && CanBypassShell(shell, shellflag) &&
+      SplitSimpleCommand(cmd, &args) && FindExecutable(args[0], path)) {
+    argv->push_back(args[0].as_string());
+    for (size_t i = 1; i < args.size(); i++)
+      argv->push_back(args[i].as_string());
+    return true;
+  }
+
+  GetShellArgv(shell, shellflag, cmd, argv);
+  *path = (*argv)[0];
+  return false;
+}
+
+pid_t Spawn(const string& path,
+            const vector<string>& args,
+            bool is_direct,
+            RedirectStderr redirect_stderr,
+            int pipe_fd,
+            int stderr_fd,
+            bool new_group) {
+  vector<char*> argv;
+  for (const string& a : args)
+    argv.push_back(const_cast<char*>(a.c_str()));
+  argv.push_back(NULL);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (redirect_stderr == RedirectStderr::STDOUT) {
+    posix_spawn_file_actions_adddup2(&actions, pipe_fd, 2);
+  } else if (redirect_stderr == RedirectStderr::DEV_NULL) {
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+  } else if (stderr_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, stderr_fd, 2);
+  }
+  // dup2 clears close-on-exec on the child's copies.
+  posix_spawn_file_actions_adddup2(&actions, pipe_fd, 1);
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  if (new_group) {
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+  }
+
+  pid_t pid;
+  int r;
+  if (is_direct) {
+    r = posix_spawn(&pid, path.c_str(), &actions, &attr, argv.data(), environ);
+  } else {
+    r = posix_spawnp(&pid, path.c_str(), &actions, &attr, argv.data(),
+                     environ);
+  }
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  if (r != 0) {
+    errno = r;
+    return -1;
+  }
+  return pid;
+}
+
+// Children with a deadline run in their own process group, so the whole
+// group is killed and no grandchild keeps the pipe open. Others stay in
+// ours to get terminal signals such as SIGINT.
+void KillChild(Subprocess* p) {
+  kill(p->deadline != 0 ? -p->pid : p->pid, SIGKILL);
+}
+
+int OpenPidfd(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  int fd = syscall(SYS_pidfd_open, pid, 0);
+  if (fd >= 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+    PERROR("fcntl failed");
+  return fd;
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+}  // namespace
+
+#if defined(__linux__)
+
+class ProcessRunner::Poller {
+ public:
+  Poller() {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0)
+      PERROR("epoll_create1 failed");
+  }
+
+  ~Poller() { close(epfd_); }
+
+  void Add(int fd) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+      PERROR("epoll_ctl failed");
+  }
+
+  void Remove(int fd) {
+    if (epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, NULL) < 0)
+      PERROR("epoll_ctl failed");
+  }
+
+  void Wait(int timeout, vector<int>* ready) {
+    struct epoll_event evs[64];
+    int n = HANDLE_EINTR(epoll_wait(epfd_, evs, 64, timeout));
+    if (n < 0)
+      PERROR("epoll_wait failed");
+    for (int i = 0; i < n; i++)
+      ready->push_back(evs[i].data.fd);
+  }
+
+ private:
+  int epfd_;
+};
+
+#else
+
+class ProcessRunner::Poller {
+ public:
+  void Add(int fd) { fds_.push_back(fd); }
+
+  void Remove(int fd) { fds_.erase(find(fds_.begin(), fds_.end(), fd)); }
+
+  void Wait(int timeout, vector<int>* ready) {
+    vector<struct pollfd> pfds(fds_.size());
+    for (size_t i = 0; i < fds_.size(); i++) {
+      pfds[i].fd = fds_[i];
+      pfds[i].events = POLLIN;
+      pfds[i].revents = 0;
+    }
+    if (HANDLE_EINTR(poll(pfds.data(), pfds.size(), timeout)) < 0)
+      PERROR("poll failed");
+    for (const struct pollfd& pfd : pfds) {
+      if (pfd.revents)
+        ready->push_back(pfd.fd);
+    }
+  }
+
+ private:
+  vector<int> fds_;
+};
+
+#endif
+
+Subprocess::Subprocess()
+    : pid(-1),
+      fd(-1),
+      pidfd(-1),
+      status(0),
+      rusage(),
+      deadline(0),
+      timed_out(false),
+      eof_(false),
+      exited_(false) {}
+
+ProcessRunner::ProcessRunner() : poller_(new Poller()) {}
+
+ProcessRunner::~ProcessRunner() {
+  for (Subprocess* p : running_) {
+    KillChild(p);
+    Reap(p, true);
+    if (p->fd >= 0)
+      close(p->fd);
+    delete p;
+  }
+  for (Subprocess* p : finished_)
+    delete p;
+}
+
+void GetShellArgv(const string& shell,
+                  const string& shellflag,
+                  const string& cmd,
+                  vector<string>* argv) {
+  if (shell[0] != '/' || shell.find_first_of(" $") != string::npos) {
+    string cmd_escaped = cmd;
+    EscapeShell(&cmd_escaped);
+    argv->push_back("/bin/sh");
+    argv->push_back("-c");
+    argv->push_back(shell + " " + shellflag + " \"" + cmd_escaped + "\"");
+  } else {
+    // If the shell isn't complicated, we don't need to wrap in /bin/sh
+    argv->push_back(shell);
+    argv->push_back(shellflag);
+    argv->push_back(cmd);
+  }
+}
+
+Subprocess* ProcessRunner::Start(const string& shell,
+                                 const string& shellflag,
+                                 const string& cmd,
+                                 RedirectStderr redirect_stderr,
+                                 double timeout,
+                                 int stderr_fd) {
+  CHECK(stderr_fd < 0 || redirect_stderr == RedirectStderr::NONE);
+  string path;
+  vector<string> argv;
+  bool is_direct = GetArgv(shell, shellflag, cmd, true, &path, &argv);
+
+  // Other children may be spawned concurrently, e.g. from the regen glob
+  // threads, so neither end may leak into them.
+  int pipefd[2];
+#if defined(__linux__)
+  if (pipe2(pipefd, O_CLOEXEC) != 0)
+    PERROR("pipe2 failed");
+#else
+  if (pipe(pipefd) != 0)
+    PERROR("pipe failed");
+  if (fcntl(pipefd[0], F_SETFD, FD_CLOEXEC) < 0 ||
+      fcntl(pipefd[1], F_SETFD, FD_CLOEXEC) < 0)
+    PERROR("fcntl failed");
+#endif
+
+  bool new_group = timeout > 0;
+  pid_t pid = Spawn(path, argv, is_direct, redirect_stderr, pipefd[1],
+                    stderr_fd, new_group);
+  if (pid < 0 && is_direct) {
+    // E.g. ENOEXEC for a script without #!, which the shell would run.
+    argv.clear();
+    GetArgv(shell, shellflag, cmd, false, &path, &argv);
+    pid = Spawn(path, argv, false, redirect_stderr, pipefd[1], stderr_fd,
+                new_group);
+  }
+  if (pid < 0)
+    PERROR("posix_spawn for %s failed", path.c_str());
+  close(pipefd[1]);
+
+  Subprocess* p = new Subprocess();
+  p->pid = pid;
+  p->fd = pipefd[0];
+  p->pidfd = OpenPidfd(pid);
+  if (timeout > 0)
+    p->deadline = GetTime() + timeout;
+  running_.push_back(p);
+  fds_[p->fd] = p;
+  poller_->Add(p->fd);
+  if (p->pidfd >= 0) {
+    fds_[p->pidfd] = p;
+    poller_->Add(p->pidfd);
+  }
+  return p;
+}
+
+Subprocess* ProcessRunner::Wait(int watch_fd) {
+  if (watch_fd >= 0)
+    poller_->Add(watch_fd);
+  while (finished_.empty()) {
+    CHECK(!running_.empty() || watch_fd >= 0);
+    vector<int> ready;
+    poller_->Wait(NextTimeout(), &ready);
+    KillExpired();
+    bool watch_fd_ready = false;
+    for (int fd : ready) {
+      if (fd == watch_fd)
+        watch_fd_ready = true;
+      else
+        HandleEvent(fd);
+    }
+    if (watch_fd_ready)
+      break;
+  }
+  if (watch_fd >= 0)
+    poller_->Remove(watch_fd);
+
+  if (finished_.empty())
+    return NULL;
+  Subprocess* p = finished_.front();
+  finished_.pop_front();
+  return p;
+}
+
+void ProcessRunner::HandleEvent(int fd) {
+  auto found = fds_.find(fd);
+  // Already closed while handling an earlier event.
+  if (found == fds_.end())
+    return;
+  Subprocess* p = found->second;
+  if (fd == p->fd) {
+    ReadOutput(p);
+  } else {
+    Reap(p, false);
+  }
+  MaybeFinish(p);
+}
+
+void ProcessRunner::ReadOutput(Subprocess* p) {
+  char buf[64 * 1024];
+  ssize_t r = HANDLE_EINTR(read(p->fd, buf, sizeof(buf)));
+  if (r < 0)
+    PERROR("read failed");
+  if (r > 0) {
+    p->output.append(buf, r);
+    return;
+  }
+
+  poller_->Remove(p->fd);
+  fds_.erase(p->fd);
+  close(p->fd);
+  p->fd = -1;
+  p->eof_ = true;
+  // Without a pidfd, we only learn about the exit by waiting for it.
+  if (p->pidfd < 0)
+    Reap(p, true);
+}
+
+void ProcessRunner::Reap(Subprocess* p, bool block) {
+  if (p->exited_)
+    return;
+  pid_t r = HANDLE_EINTR(wait4(p->pid, &p->status, block ? 0 : WNOHANG,
+                               &p->rusage));
+  if (r < 0)
+    PERROR("wait4 failed");
+  if (r == 0)
+    return;
+  p->exited_ = true;
+  if (p->pidfd >= 0) {
+    poller_->Remove(p->pidfd);
+    fds_.erase(p->pidfd);
+    close(p->pidfd);
+    p->pidfd = -1;
+  }
+}
+
+void ProcessRunner::MaybeFinish(Subprocess* p) {
+  // Keep reading after the exit, as grandchildren may still write.
+  if (!p->eof_ || !p->exited_)
+    return;
+  running_.erase(find(running_.begin(), running_.end(), p));
+  finished_.push_back(p);
+}
+
+int ProcessRunner::NextTimeout() const {
+  double deadline = 0;
+  for (Subprocess* p : running_) {
+    if (p->deadline > 0 && !p->timed_out &&
+        (deadline == 0 || p->deadline < deadline)) {
+      deadline = p->deadline;
+    }
+  }
+  if (deadline == 0)
+    return -1;
+  return max(0, static_cast<int>((deadline - GetTime()) * 1000) + 1);
+}
+
+void ProcessRunner::KillExpired() {
+  double now = 0;
+  for (Subprocess* p : running_) {
+    if (p->deadline == 0 || p->timed_out || p->exited_)
+      continue;
+    if (now == 0)
+      now = GetTime();
+    if (p->deadline <= now) {
+      KillChild(p);
+      p->timed_out = true;
+    }
+  }
+}
@@ -0,0 +1,105 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PROCESS_H_
+#define PROCESS_H_
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fileutil.h"
+
+using namespace std;
+
+// A child process started by ProcessRunner.
+struct Subprocess {
+  Subprocess();
+
+  pid_t pid;
+  // Read end of the child's stdout pipe. -1 once it has been closed.
+  int fd;
+  // A pidfd for the child if the kernel supports them, or -1.
+  int pidfd;
+  // Everything the child wrote to |fd|.
+  string output;
+  // Valid once the process has finished.
+  int status;
+  struct rusage rusage;
+  // GetTime() after which the child is killed, or 0 for no timeout.
+  double deadline;
+  bool timed_out;
+
+ private:
+  bool eof_;
+  bool exited_;
+
+  friend class ProcessRunner;
+};
+
+// Fills |argv| with the arguments to run |cmd| with |shell|.
+void GetShellArgv(const string& shell,
+                  const string& shellflag,
+                  const string& cmd,
+                  vector<string>* argv);
+
+// Runs any number of children concurrently, capturing their output.
+// Children are spawned with posix_spawn and watched with epoll and pidfds
+// where available, or poll() otherwise.
+class ProcessRunner {
+ public:
+  ProcessRunner();
+  ~ProcessRunner();
+
+  // Starts |cmd| with |shell| (or without one when it is a simple
+  // command, see SplitSimpleCommand). The child is killed if it is still
+  // running after |timeout| seconds, unless |timeout| is 0, together with
+  // the processes it started. If |stderr_fd| is not -1, the child's stderr
+  // goes there instead and |redirect_stderr| must be NONE.
+  Subprocess* Start(const string& shell,
+                    const string& shellflag,
+                    const string& cmd,
+                    RedirectStderr redirect_stderr,
+                    double timeout = 0,
+                    int stderr_fd = -1);
+
+  // Blocks until a child has exited and closed its output, or until
+  // |watch_fd| becomes readable. Returns the finished child, which the
+  // caller owns, or NULL if only |watch_fd| is ready.
+  Subprocess* Wait(int watch_fd = -1);
+
+  size_t num_running() const { return running_.size(); }
+
+ private:
+  void HandleEvent(int fd);
+  void ReadOutput(Subprocess* p);
+  void Reap(Subprocess* p, bool block);
+  void MaybeFinish(Subprocess* p);
+  int NextTimeout() const;
+  void KillExpired();
+
+  class Poller;
+  unique_ptr<Poller> poller_;
+  // Both pipe fds and pidfds of running children.
+  unordered_map<int, Subprocess*> fds_;
+  vector<Subprocess*> running_;
+  deque<Subprocess*> finished_;
+};
+
+#endif  // PROCESS_H_
@@ -19,6 +19,7 @@
 #include <sys/stat.h>
 
 #include <algorithm>
+#include <atomic>
 #include <future>
 #include <memory>
 #include <mutex>
@@ -53,6 +54,7 @@ bool ShouldIgnoreDirty(StringPiece s) {
 class StampChecker {
   struct GlobResult {
     string pat;
+    vector<string> read_dirs;
     vector<string> result;
   };
 
@@ -155,6 +157,12 @@ class StampChecker {
     if (g_flags.regen_debug)
       printf("Generated time: %f\n", gen_time);
 
+    if (LoadInt(fp) != kNinjaStampVersion) {
+      // The rest of it cannot be read.
+      fprintf(stderr, "kati_stamp has another version, regenerating...\n");
+      return true;
+    }
+
     string s, s2;
     int num_files = LOAD_INT(fp);
     for (int i = 0; i < num_files; i++) {
@@ -228,6 +236,11 @@ class StampChecker {
       globs_.push_back(gr);
 
       LOAD_STRING(fp, &gr->pat);
+      int num_read_dirs = LOAD_INT(fp);
+      gr->read_dirs.resize(num_read_dirs);
+      for (int j = 0; j < num_read_dirs; j++) {
+        LOAD_STRING(fp, &gr->read_dirs[j]);
+      }
       int num_files = LOAD_INT(fp);
       gr->result.resize(num_files);
       for (int j = 0; j < num_files; j++) {
@@ -278,7 +291,48 @@ class StampChecker {
     return needs_regen_;
   }
 
+  // Returns true if |dir| may have been modified since the last
+  // generation, i.e. entries may have been added to or removed from it.
+  bool IsDirModified(const string& dir) {
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0) {
+      return true;
+    }
+    double ts = GetTimestampFromStat(st);
+    if (gen_time_ < ts) {
+      return true;
+    }
+    if (S_ISLNK(st.st_mode)) {
+      ts = GetTimestamp(dir);
+      if (ts < 0 || gen_time_ < ts)
+        return true;
+    }
+    return false;
+  }
+
+  bool ShouldRunGlob(const GlobResult* gr) {
+    // No directories are recorded for plain file names, which are checked
+    // with a single stat anyway.
+    if (gr->read_dirs.empty())
+      return true;
+
+    COLLECT_STATS("stat time (regen)");
+    for (const string& dir : gr->read_dirs) {
+      // Unlike find, wildcards in the top directory are common, and the
+      // top directory is modified by every generation, so just re-glob.
+      if (dir == "." || IsDirModified(dir))
+        return true;
+    }
+    return false;
+  }
+
   bool CheckGlobResult(const GlobResult* gr, string* err) {
+    if (!ShouldRunGlob(gr)) {
+      if (g_flags.regen_debug)
+        printf("wildcard %s: clean (no reglob)\n", gr->pat.c_str());
+      return false;
+    }
+
     COLLECT_STATS("glob time (regen)");
     vector<string>* files;
     Glob(gr->pat.c_str(), &files);
@@ -328,20 +382,8 @@ class StampChecker {
       // directory which affects the results of find command.
       if (dir == "" || dir == "." || ShouldIgnoreDirty(dir))
         continue;
-
-      struct stat st;
-      if (lstat(dir.c_str(), &st) != 0) {
+      if (IsDirModified(dir))
         return true;
-      }
-      double ts = GetTimestampFromStat(st);
-      if (gen_time_ < ts) {
-        return true;
-      }
-      if (S_ISLNK(st.st_mode)) {
-        ts = GetTimestamp(dir);
-        if (ts < 0 || gen_time_ < ts)
-          return true;
-      }
     }
     return false;
   }
@@ -430,21 +472,32 @@ class StampChecker {
   }
 
   bool CheckStep2() {
-    auto glob_future = std::async([this]() {
+    // Globs are cheap, so the workers take them one by one from a shared
+    // index rather than each getting a task.
+    atomic<size_t> next_glob(0);
+    atomic<bool> glob_dirty(false);
+    auto check_globs = [this, &next_glob, &glob_dirty]() {
       string err;
-      // TODO: Make glob cache thread safe and create a task for each glob.
-      SetAffinityForSingleThread();
-      for (GlobResult* gr : globs_) {
-        if (CheckGlobResult(gr, &err)) {
+      for (size_t i = next_glob++; i < globs_.size() && !glob_dirty;
+           i = next_glob++) {
+        if (CheckGlobResult(globs_[i], &err)) {
+          glob_dirty = true;
           unique_lock<mutex> lock(mu_);
           if (!needs_regen_) {
             needs_regen_ = true;
             msg_ = err;
           }
-          break;
+          return;
         }
       }
-    });
+    };
+    const size_t kGlobsPerThread = 256;
+    size_t num_glob_threads =
+        min<size_t>(max(g_flags.num_cpus - 1, 1),
+                    (globs_.size() + kGlobsPerThread - 1) / kGlobsPerThread);
+    vector<future<void>> glob_futures;
+    for (size_t i = 0; i < num_glob_threads; i++)
+      glob_futures.push_back(std::async(std::launch::async, check_globs));
 
     auto shell_future = std::async([this]() {
       SetAffinityForSingleThread();
@@ -460,7 +513,8 @@ class StampChecker {
       }
     });
 
-    glob_future.wait();
+    for (future<void>& f : glob_futures)
+      f.wait();
     shell_future.wait();
     if (needs_regen_) {
       fprintf(stderr, "%s", msg_.c_str());
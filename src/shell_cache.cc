@@ -0,0 +1,464 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// +build ignore
+
+#include "shell_cache.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "file_tracer.h"
+#include "fileutil.h"
+#include "flags.h"
+#include "io.h"
+#include "log.h"
+#include "strutil.h"
+#include "timeutil.h"
+
+extern "C" char** environ;
+
+namespace {
+
+const char kShellCacheVersion[] = "kati shell cache 2";
+
+// File timestamps may lag behind GetTime() by a clock tick, so inputs
+// modified this close to the start of a command are not trusted.
+const double kTimestampSlack = 1.0;
+
+const double kDirectory = -3.0;
+
+struct ShellCacheInput {
+  string path;
+  bool opened;
+  double stamp;
+};
+
+struct ShellCacheEntry {
+  string result;
+  vector<ShellCacheInput> inputs;
+  // Whether the entry was checked against the file system in this run.
+  bool checked;
+  bool valid;
+};
+
+string GetEnvironment() {
+  string env;
+  for (char** p = environ; *p; p++) {
+    env += *p;
+    env += '\0';
+  }
+  return env;
+}
+
+// Returns what a command could have seen of |path|: the timestamp of a
+// file or of a directory it opened, or only the existence of a directory
+// it looked up, e.g. as its working directory.
+double GetInputStamp(const string& path, bool opened) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0)
+    return -2.0;
+  if (!opened && S_ISDIR(st.st_mode))
+    return kDirectory;
+  return GetTimestampFromStat(st);
+}
+
+// Commands whose output only depends on their arguments, the environment,
+// the working directory and the files they read, and which do not change
+// the file system. Only commands made of these are cached.
+const char* const kCacheableCommands[] = {
+    "[",     "basename", "cat",       "cd",       "cmp",
+    "comm",  "cut",      "diff",      "dirname",  "echo",
+    "egrep", "expr",     "false",     "fgrep",    "find",
+    "grep",  "head",     "join",      "ls",       "md5sum",
+    "paste", "printf",   "pwd",       "readlink", "realpath",
+    "seq",   "sha1sum",  "sha256sum", "sort",     "tac",
+    "tail",  "test",     "tr",        "true",     "uniq",
+    "wc",
+};
+
+// Commands which do not change the file system either, but whose output
+// depends on more than what kati can trace.
+const char* const kReadOnlyCommands[] = {
+    "date", "hostname", "id", "nproc", "sleep", "stat", "uname", "whoami",
+};
+
+// Shell keywords and wrappers which run the next word as a command.
+const char* const kCommandPrefixes[] = {
+    "builtin", "command", "do",   "elif",  "else",  "env",
+    "exec",    "if",      "then", "until", "while", "xargs",
+};
+
+bool IsOneOf(StringPiece w, const char* const* words, size_t num_words) {
+  for (size_t i = 0; i < num_words; i++) {
+    if (w == words[i])
+      return true;
+  }
+  return false;
+}
+
+bool IsCommandSeparator(char c) {
+  return c != '\0' && strchr(";|&(){}!\n", c) != NULL;
+}
+
+StringPiece StripQuotes(StringPiece w) {
+  while (!w.empty() && (w[0] == '"' || w[0] == '\''))
+    w = w.substr(1);
+  while (!w.empty() && (w[w.size() - 1] == '"' || w[w.size() - 1] == '\''))
+    w = w.substr(0, w.size() - 1);
+  return w;
+}
+
+// Whether |cmd| redirects output anywhere but /dev/null or another fd.
+bool HasOutputRedirection(StringPiece cmd) {
+  for (size_t i = cmd.find('>'); i != string::npos;
+       i = cmd.find('>', i + 1)) {
+    size_t j = i + 1;
+    if (j < cmd.size() && cmd[j] == '>')
+      j++;
+    while (j < cmd.size() && cmd[j] == ' ')
+      j++;
+    StringPiece target = cmd.substr(j);
+    if (!HasPrefix(target, "&") && !HasPrefix(target, "/dev/null"))
+      return true;
+    i = j;
+  }
+  return false;
+}
+
+// Whether an argument of one of kCacheableCommands makes it run other
+// commands or write files.
+bool IsWritingOption(StringPiece cmd, StringPiece arg) {
+  if (cmd == "find") {
+    return HasPrefix(arg, "-exec") || HasPrefix(arg, "-ok") ||
+           HasPrefix(arg, "-fprint") || arg == "-fls" || arg == "-delete";
+  }
+  if (cmd == "sort") {
+    if (HasPrefix(arg, "--"))
+      return HasPrefix(arg, "--output");
+    return arg.size() > 1 && arg[0] == '-' && arg.find('o') != string::npos;
+  }
+  return false;
+}
+
+// Whether an argument of one of kCacheableCommands makes it look at
+// something not recorded as its input, such as timestamps or random
+// numbers.
+bool IsUnrepeatableOption(StringPiece cmd, StringPiece arg) {
+  if (cmd == "ls") {
+    if (HasPrefix(arg, "--"))
+      return HasPrefix(arg, "--full-time") || HasPrefix(arg, "--time") ||
+             HasPrefix(arg, "--sort") || arg == "--format=long" ||
+             arg == "--format=verbose";
+    return arg.size() > 1 && arg[0] == '-' &&
+           arg.find_first_of("lgnotuc") != string::npos;
+  }
+  if (cmd == "find") {
+    return HasPrefix(arg, "-newer") || arg == "-ls" ||
+           HasSuffix(arg, "printf") || HasSuffix(arg, "time") ||
+           HasSuffix(arg, "min");
+  }
+  if (cmd == "sort") {
+    if (HasPrefix(arg, "--"))
+      return HasPrefix(arg, "--random");
+    return arg.size() > 1 && arg[0] == '-' && arg.find('R') != string::npos;
+  }
+  return false;
+}
+
+// Whether running |cmd| leaves the file system as it was. Every command it
+// runs must be one of kCacheableCommands, or, unless |repeatable|, one of
+// kReadOnlyCommands. If |repeatable|, running it again with the same inputs
+// must also print the same output. Commands with anything expanded by the
+// shell itself, such as variables or nested commands, are rejected.
+bool IsReadOnly(StringPiece cmd, bool repeatable) {
+  if (cmd.find_first_of("$`") != string::npos || HasOutputRedirection(cmd))
+    return false;
+  if (repeatable && (cmd.find("/dev/random") != string::npos ||
+                     cmd.find("/dev/urandom") != string::npos)) {
+    return false;
+  }
+  size_t i = 0;
+  while (i < cmd.size()) {
+    size_t end = i;
+    while (end < cmd.size() && !IsCommandSeparator(cmd[end]))
+      end++;
+    StringPiece name;
+    bool skip_next = false;
+    for (StringPiece tok : WordScanner(cmd.substr(i, end - i))) {
+      StringPiece w = StripQuotes(tok);
+      if (skip_next) {
+        skip_next = false;
+        continue;
+      }
+      // Redirections, with their target if it is a separate word.
+      size_t redir = w.find_first_of("<>");
+      if (redir != string::npos &&
+          w.substr(0, redir).find_first_not_of("0123456789") ==
+              string::npos) {
+        skip_next = w.find_first_not_of("0123456789<>", redir) ==
+                    string::npos;
+        continue;
+      }
+      if (name.empty()) {
+        // Variable assignments and wrappers with their options come before
+        // the command name.
+        if (w.empty() || w.find('=') != string::npos || w[0] == '-' ||
+            isdigit(static_cast<unsigned char>(w[0])) ||
+            IsOneOf(Basename(w), kCommandPrefixes,
+                    sizeof(kCommandPrefixes) / sizeof(kCommandPrefixes[0]))) {
+          continue;
+        }
+        name = Basename(w);
+        if (IsOneOf(name, kCacheableCommands,
+                    sizeof(kCacheableCommands) /
+                        sizeof(kCacheableCommands[0]))) {
+          continue;
+        }
+        if (repeatable ||
+            !IsOneOf(name, kReadOnlyCommands,
+                     sizeof(kReadOnlyCommands) /
+                         sizeof(kReadOnlyCommands[0]))) {
+          return false;
+        }
+      } else if (IsWritingOption(name, w) ||
+                 (repeatable && IsUnrepeatableOption(name, w))) {
+        return false;
+      }
+    }
+    i = end + 1;
+  }
+  return true;
+}
+
+// Whether running |cmd| again with the same inputs prints the same output
+// and has no other effect.
+bool IsCacheable(StringPiece cmd) {
+  return IsReadOnly(cmd, true);
+}
+
+class ShellCache {
+ public:
+  explicit ShellCache(const char* filename)
+      : filename_(filename), num_hits_(0), num_misses_(0) {}
+
+  ~ShellCache() {
+    for (auto& p : entries_)
+      delete p.second;
+  }
+
+  void Load() {
+    FILE* fp = fopen(filename_.c_str(), "rb");
+    if (!fp)
+      return;
+    ScopedFile sfp(fp);
+
+    string version;
+    if (!LoadString(fp, &version) || version != kShellCacheVersion) {
+      LOG("Shell cache ignored: unknown version");
+      return;
+    }
+    string env;
+    if (!LoadString(fp, &env) || env != GetEnvironment()) {
+      LOG("Shell cache ignored: the environment changed");
+      return;
+    }
+    int num_entries = LoadInt(fp);
+    for (int i = 0; i < num_entries; i++) {
+      string key;
+      unique_ptr<ShellCacheEntry> e(new ShellCacheEntry());
+      e->checked = e->valid = false;
+      if (!LoadString(fp, &key) || !LoadString(fp, &e->result))
+        break;
+      int num_inputs = LoadInt(fp);
+      for (int j = 0; j < num_inputs; j++) {
+        ShellCacheInput input;
+        int opened = LoadInt(fp);
+        if (opened < 0 || !LoadString(fp, &input.path) ||
+            fread(&input.stamp, sizeof(input.stamp), 1, fp) != 1) {
+          break;
+        }
+        input.opened = opened;
+        e->inputs.push_back(input);
+      }
+      if (static_cast<int>(e->inputs.size()) != num_inputs)
+        break;
+      entries_[key] = e.release();
+    }
+    LOG("Shell cache: %zu entries loaded", entries_.size());
+  }
+
+  void Save() {
+    const string tmp = filename_ + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+      PERROR("fopen(%s) failed", tmp.c_str());
+
+    DumpString(fp, kShellCacheVersion);
+    DumpString(fp, GetEnvironment());
+    // Entries not used in this run are dropped.
+    vector<pair<const string*, ShellCacheEntry*>> live;
+    for (const auto& p : entries_) {
+      if (p.second->checked && p.second->valid)
+        live.emplace_back(&p.first, p.second);
+    }
+    DumpInt(fp, live.size());
+    for (const auto& p : live) {
+      DumpString(fp, *p.first);
+      DumpString(fp, p.second->result);
+      DumpInt(fp, p.second->inputs.size());
+      for (const ShellCacheInput& input : p.second->inputs) {
+        DumpInt(fp, input.opened);
+        DumpString(fp, input.path);
+        size_t r = fwrite(&input.stamp, sizeof(input.stamp), 1, fp);
+        CHECK(r == 1);
+      }
+    }
+    fclose(fp);
+    if (rename(tmp.c_str(), filename_.c_str()) != 0)
+      PERROR("rename(%s) failed", filename_.c_str());
+
+    LOG_STAT("%d cached $(shell) results used, %d commands run", num_hits_,
+             num_misses_);
+  }
+
+  void Run(const string& shell,
+           const string& shellflag,
+           const string& cmd,
+           string* out) {
+    const string key = MakeKey(shell, shellflag, cmd);
+    ShellCacheEntry* e = Find(key);
+    if (e) {
+      num_hits_++;
+      *out += e->result;
+      return;
+    }
+
+    num_misses_++;
+    double start = GetTime();
+    string result;
+    vector<TracedInput> inputs;
+    bool complete = RunTracedCommand(shell, shellflag, cmd, &result, &inputs);
+    *out += result;
+    if (!complete || !IsCacheable(cmd)) {
+      LOG("Shell cache: %s is not cacheable", cmd.c_str());
+      return;
+    }
+
+    unique_ptr<ShellCacheEntry> ne(new ShellCacheEntry());
+    ne->result.swap(result);
+    ne->checked = ne->valid = true;
+    for (const TracedInput& input : inputs) {
+      ShellCacheInput ci;
+      ci.path = input.path;
+      ci.opened = input.opened;
+      ci.stamp = GetInputStamp(input.path, input.opened);
+      if (ci.stamp >= start - kTimestampSlack) {
+        LOG("Shell cache: %s changed while %s ran", input.path.c_str(),
+            cmd.c_str());
+        return;
+      }
+      ne->inputs.push_back(ci);
+    }
+    ShellCacheEntry*& slot = entries_[key];
+    delete slot;
+    slot = ne.release();
+  }
+
+ private:
+  // Relative paths in |cmd| and in the traced inputs are resolved from
+  // the working directory, which -C changes, so it is part of the key.
+  static string MakeKey(const string& shell,
+                        const string& shellflag,
+                        const string& cmd) {
+    string key;
+    AbsPath(".", &key);
+    key += '\0';
+    key += shell;
+    key += '\0';
+    key += shellflag;
+    key += '\0';
+    key += cmd;
+    return key;
+  }
+
+  // Returns the entry for |key| if none of its inputs changed.
+  ShellCacheEntry* Find(const string& key) {
+    auto found = entries_.find(key);
+    if (found == entries_.end())
+      return NULL;
+    ShellCacheEntry* e = found->second;
+    if (!e->checked) {
+      e->checked = true;
+      e->valid = true;
+      for (const ShellCacheInput& input : e->inputs) {
+        if (GetInputStamp(input.path, input.opened) != input.stamp) {
+          LOG("Shell cache: %s changed", input.path.c_str());
+          e->valid = false;
+          break;
+        }
+      }
+    }
+    return e->valid ? e : NULL;
+  }
+
+  string filename_;
+  unordered_map<string, ShellCacheEntry*> entries_;
+  int num_hits_;
+  int num_misses_;
+};
+
+ShellCache* g_shell_cache;
+
+}  // namespace
+
+void LoadShellCache() {
+  if (!g_flags.shell_cache)
+    return;
+  g_shell_cache = new ShellCache(g_flags.shell_cache);
+  g_shell_cache->Load();
+}
+
+void SaveShellCache() {
+  if (!g_shell_cache)
+    return;
+  g_shell_cache->Save();
+  delete g_shell_cache;
+  g_shell_cache = NULL;
+}
+
+bool RunShellCommandWithCache(const string& shell,
+                              const string& shellflag,
+                              const string& cmd,
+                              string* out) {
+  if (!g_shell_cache)
+    return false;
+  g_shell_cache->Run(shell, shellflag, cmd, out);
+  return true;
+}
+
+bool IsShellCommandCacheable(const string& cmd) {
+  return g_shell_cache && IsCacheable(cmd);
+}
+
+bool IsShellCommandReadOnly(const string& cmd) {
+  return IsReadOnly(cmd, false);
+}
@@ -0,0 +1,47 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHELL_CACHE_H_
+#define SHELL_CACHE_H_
+
+#include <string>
+
+using namespace std;
+
+// A cache of $(shell) results kept across runs in the file given by
+// --shell_cache. Only commands made of tools known to depend on nothing
+// but their arguments and the files they read are cached. They are traced
+// to find the files they look at, and a result is reused in the same
+// working directory while none of those files changed.
+
+void LoadShellCache();
+void SaveShellCache();
+
+// Appends the output of |cmd| to |out|, from the cache if possible.
+// Returns false if the cache is disabled.
+bool RunShellCommandWithCache(const string& shell,
+                              const string& shellflag,
+                              const string& cmd,
+                              string* out);
+
+// Whether the result of |cmd| is kept in the cache. Such commands must go
+// through RunShellCommandWithCache rather than be run some other way, e.g.
+// speculatively, so the files they read are recorded.
+bool IsShellCommandCacheable(const string& cmd);
+
+// Whether |cmd| is only made of commands known to leave the file system as
+// it was, so it may be run ahead of the commands before it.
+bool IsShellCommandReadOnly(const string& cmd);
+
+#endif  // SHELL_CACHE_H_
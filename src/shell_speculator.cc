@@ -0,0 +1,216 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// +build ignore
+
+#include "shell_speculator.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+#include "eval.h"
+#include "find.h"
+#include "flags.h"
+#include "log.h"
+#include "process.h"
+#include "shell_cache.h"
+#include "stmt.h"
+#include "symtab.h"
+
+namespace {
+
+struct Speculation {
+  Speculation() : stderr_file(NULL) {}
+  ~Speculation() {
+    if (stderr_file)
+      fclose(stderr_file);
+  }
+
+  string shell;
+  string shellflag;
+  // The command's stderr, printed when its result is taken so it shows up
+  // in evaluation order.
+  FILE* stderr_file;
+  // NULL until the command finishes.
+  unique_ptr<Subprocess> result;
+};
+
+class ShellSpeculator {
+ public:
+  ShellSpeculator() : num_started_(0), num_taken_(0) {}
+
+  void Start(const string& shell, const string& shellflag, const string& cmd) {
+    // Spare the CPUs for the evaluator and for commands actually needed.
+    if (runner_.num_running() >= static_cast<size_t>(g_flags.num_jobs))
+      return;
+    // The find emulator answers these without running anything.
+    if (FindEmulator::Get()) {
+      FindCommand fc;
+      if (fc.Parse(cmd))
+        return;
+    }
+    // Commands kept in the shell cache are run by it, so the files they
+    // read are recorded.
+    if (IsShellCommandCacheable(cmd))
+      return;
+    LOG("Speculative shell: %s", cmd.c_str());
+    Speculation* s = new Speculation();
+    s->shell = shell;
+    s->shellflag = shellflag;
+    s->stderr_file = tmpfile();
+    if (!s->stderr_file)
+      PERROR("tmpfile failed");
+    int stderr_fd = fileno(s->stderr_file);
+    if (fcntl(stderr_fd, F_SETFD, FD_CLOEXEC) < 0)
+      PERROR("fcntl failed");
+    Subprocess* p = runner_.Start(shell, shellflag, cmd, RedirectStderr::NONE,
+                                  0, stderr_fd);
+    running_[p] = s;
+    speculations_[cmd].push_back(s);
+    num_started_++;
+  }
+
+  bool Take(const string& shell,
+            const string& shellflag,
+            const string& cmd,
+            string* out) {
+    auto found = speculations_.find(cmd);
+    if (found == speculations_.end())
+      return false;
+    deque<Speculation*>& q = found->second;
+    Speculation* s = q.front();
+    q.pop_front();
+    if (q.empty())
+      speculations_.erase(found);
+    // The command does not change the file system, so it is simply run
+    // again with the right shell. The stale result is dropped once the
+    // speculative run finishes.
+    if (s->shell != shell || s->shellflag != shellflag) {
+      LOG("Speculative shell with another shell: %s", cmd.c_str());
+      abandoned_.push_back(s);
+      return false;
+    }
+    while (!s->result)
+      WaitOne();
+    CopyStderr(s);
+    *out += s->result->output;
+    delete s;
+    num_taken_++;
+    return true;
+  }
+
+  void Finish() {
+    while (!running_.empty())
+      WaitOne();
+    for (auto& p : speculations_) {
+      for (Speculation* s : p.second)
+        delete s;
+    }
+    speculations_.clear();
+    for (Speculation* s : abandoned_)
+      delete s;
+    abandoned_.clear();
+    if (num_started_) {
+      LOG_STAT("%d of %d speculative $(shell) results used", num_taken_,
+               num_started_);
+    }
+  }
+
+ private:
+  static void CopyStderr(Speculation* s) {
+    fflush(stdout);
+    rewind(s->stderr_file);
+    char buf[4096];
+    size_t r;
+    while ((r = fread(buf, 1, sizeof(buf), s->stderr_file)) > 0) {
+      size_t w = fwrite(buf, 1, r, stderr);
+      CHECK(w == r);
+    }
+  }
+
+  void WaitOne() {
+    Subprocess* p = runner_.Wait();
+    auto found = running_.find(p);
+    CHECK(found != running_.end());
+    found->second->result.reset(p);
+    running_.erase(found);
+  }
+
+  ProcessRunner runner_;
+  unordered_map<Subprocess*, Speculation*> running_;
+  // Speculations not taken yet, in the order they were started.
+  unordered_map<string, deque<Speculation*>> speculations_;
+  // Speculations run with a shell other than the one finally used.
+  vector<Speculation*> abandoned_;
+  int num_started_;
+  int num_taken_;
+};
+
+ShellSpeculator* g_speculator;
+
+}  // namespace
+
+void SpeculateShellCommands(const vector<Stmt*>& stmts, Evaluator* ev) {
+  if (!g_flags.speculative_shell)
+    return;
+  // Only the statements before the first one with other side effects are
+  // considered. They are certain to run, and nothing else they do can
+  // change the commands' results or depend on them.
+  vector<StringPiece> cmds;
+  SymbolSet deferred_vars;
+  for (Stmt* stmt : stmts) {
+    vector<StringPiece> stmt_cmds;
+    if (!stmt->GetSpeculativeShellCommands(ev, &deferred_vars, &stmt_cmds))
+      break;
+    cmds.insert(cmds.end(), stmt_cmds.begin(), stmt_cmds.end());
+  }
+  if (cmds.empty())
+    return;
+
+  if (!g_speculator)
+    g_speculator = new ShellSpeculator();
+  const string&& shell = ev->GetShell();
+  const string&& shellflag = ev->GetShellFlag();
+  for (StringPiece cmd : cmds) {
+    string c = cmd.as_string();
+    // A command which may write files could change what the ones after it
+    // print, e.g. $(shell mkdir -p d) followed by $(shell ls d). Neither it
+    // nor anything after it is started ahead of time.
+    if (!IsShellCommandReadOnly(c))
+      break;
+    g_speculator->Start(shell, shellflag, c);
+  }
+}
+
+bool TakeSpeculativeShellResult(const string& shell,
+                                const string& shellflag,
+                                const string& cmd,
+                                string* out) {
+  if (!g_speculator)
+    return false;
+  return g_speculator->Take(shell, shellflag, cmd, out);
+}
+
+void FinishSpeculativeShellCommands() {
+  if (!g_speculator)
+    return;
+  g_speculator->Finish();
+  delete g_speculator;
+  g_speculator = NULL;
+}
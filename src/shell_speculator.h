@@ -0,0 +1,46 @@
+// Copyright 2026 Google Inc. All rights reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHELL_SPECULATOR_H_
+#define SHELL_SPECULATOR_H_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Evaluator;
+struct Stmt;
+
+// Starts the literal $(shell) commands of the top-level assignments in
+// |stmts| in the background, with the current shell of |ev|. Only the
+// statements before the first one which may have any other side effect
+// are looked at, and only the commands before the first one which may
+// write to the file system are started. Does nothing unless
+// --speculative_shell is given.
+void SpeculateShellCommands(const vector<Stmt*>& stmts, Evaluator* ev);
+
+// Appends the output of |cmd| to |out| if it was started speculatively,
+// waiting for it to finish and printing what it wrote to stderr. Returns
+// false if |cmd| was not started, or was started with a shell other than
+// |shell| and |shellflag|, in which case the caller should run it itself.
+bool TakeSpeculativeShellResult(const string& shell,
+                                const string& shellflag,
+                                const string& cmd,
+                                string* out);
+
+// Waits for the speculative commands whose results were never taken.
+void FinishSpeculativeShellCommands();
+
+#endif  // SHELL_SPECULATOR_H_
@@ -20,6 +20,7 @@
 #include "expr.h"
 #include "stringprintf.h"
 #include "strutil.h"
+#include "var.h"
 
 Stmt::Stmt() {}
 
@@ -84,6 +85,31 @@ Symbol AssignStmt::GetLhsSymbol(Evaluator* ev) const {
   return lhs_sym_cache_;
 }
 
+bool AssignStmt::GetSpeculativeShellCommands(Evaluator* ev,
+                                             SymbolSet* deferred_vars,
+                                             vector<StringPiece>* cmds) const {
+  if (!lhs->IsLiteral())
+    return false;
+  Symbol sym = GetLhsSymbol(ev);
+  // SHELL and the special variables change how kati runs commands or
+  // evaluates later statements.
+  if (sym.empty() || sym == kShellSym || sym.str()[0] == '.')
+    return false;
+  Var* prev = ev->PeekVar(sym);
+  if (prev->ReadOnly() || prev->Deprecated() || prev->Obsolete())
+    return false;
+
+  bool prev_is_simple =
+      !strcmp(prev->Flavor(), "simple") && !deferred_vars->exists(sym);
+  if (op == AssignOp::COLON_EQ ||
+      (op == AssignOp::PLUS_EQ && prev_is_simple)) {
+    return rhs->GetSpeculativeShellCommands(ev, *deferred_vars, cmds);
+  }
+  // The right-hand side is not evaluated yet.
+  deferred_vars->insert(sym);
+  return true;
+}
+
 string CommandStmt::DebugString() const {
   return StringPrintf("CommandStmt(%s, loc=%s:%d)",
                       Value::DebugString(expr).c_str(), LOCF(loc()));
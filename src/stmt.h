@@ -60,6 +60,16 @@ struct Stmt {
 
   virtual string DebugString() const = 0;
 
+  // Appends the literal $(shell) commands this statement runs as soon as
+  // it is evaluated, and returns whether it does nothing else with side
+  // effects, see Value::GetSpeculativeShellCommands. Adds the variables
+  // the statement may make recursive to |deferred_vars|.
+  virtual bool GetSpeculativeShellCommands(Evaluator*,
+                                           SymbolSet*,
+                                           vector<StringPiece>*) const {
+    return false;
+  }
+
  protected:
   Stmt();
 
@@ -104,6 +114,10 @@ struct AssignStmt : public Stmt {
 
   Symbol GetLhsSymbol(Evaluator* ev) const;
 
+  virtual bool GetSpeculativeShellCommands(Evaluator* ev,
+                                           SymbolSet* deferred_vars,
+                                           vector<StringPiece>* cmds) const;
+
  private:
   mutable Symbol lhs_sym_cache_;
 };
@@ -96,6 +96,69 @@ void WordWriter::Write(StringPiece s) {
   AppendString(s, out_);
 }
 
+// Smaller pieces are copied, so appending many short strings does not
+// leave a long list of pieces behind.
+static const size_t kMinSharedPieceSize = 4096;
+
+Rope::Rope() : size_(0) {}
+
+void Rope::Append(StringPiece s) {
+  AppendString(s, &tail_);
+  size_ += s.size();
+}
+
+void Rope::Append(const shared_ptr<string>& s) {
+  if (s->size() < kMinSharedPieceSize) {
+    Append(StringPiece(*s));
+    return;
+  }
+  if (!tail_.empty()) {
+    pieces_.push_back(make_shared<string>(std::move(tail_)));
+    tail_.clear();
+  }
+  pieces_.push_back(s);
+  size_ += s->size();
+}
+
+void Rope::Append(const Rope& r) {
+  if (&r == this) {
+    const Rope copy = r;
+    Append(copy);
+    return;
+  }
+  for (const shared_ptr<string>& p : r.pieces_)
+    Append(p);
+  Append(StringPiece(r.tail_));
+}
+
+void Rope::AppendTo(string* out) const {
+  out->reserve(out->size() + size_);
+  for (const shared_ptr<string>& p : pieces_)
+    *out += *p;
+  *out += tail_;
+}
+
+const shared_ptr<string>& Rope::Flatten() {
+  if (pieces_.size() != 1 || !tail_.empty()) {
+    shared_ptr<string> s;
+    if (pieces_.empty()) {
+      s = make_shared<string>(std::move(tail_));
+    } else {
+      s = make_shared<string>();
+      AppendTo(s.get());
+    }
+    pieces_.assign(1, s);
+    tail_.clear();
+  }
+  return pieces_[0];
+}
+
+StringPiece Rope::str() {
+  if (pieces_.empty())
+    return tail_;
+  return *Flatten();
+}
+
 ScopedTerminator::ScopedTerminator(StringPiece s) : s_(s), c_(s[s.size()]) {
   const_cast<char*>(s_.data())[s_.size()] = '\0';
 }
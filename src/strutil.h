@@ -15,6 +15,7 @@
 #ifndef STRUTIL_H_
 #define STRUTIL_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -58,6 +59,35 @@ class WordWriter {
   bool needs_space_;
 };
 
+// A string made of pieces which may be shared with other ropes. Large
+// pieces are appended without copying, and the pieces are only
+// concatenated when a contiguous string is needed.
+class Rope {
+ public:
+  Rope();
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  void Append(StringPiece s);
+  void Append(const shared_ptr<string>& s);
+  void Append(const Rope& r);
+
+  void AppendTo(string* out) const;
+
+  // Concatenates the pieces into one, which replaces them.
+  const shared_ptr<string>& Flatten();
+  // Like Flatten, but does not allocate a shared piece for a short value.
+  StringPiece str();
+
+ private:
+  // Large pieces, never modified.
+  vector<shared_ptr<string>> pieces_;
+  // Short appends after the last piece.
+  string tail_;
+  size_t size_;
+};
+
 // Temporary modifies s[s.size()] to '\0'.
 class ScopedTerminator {
  public:
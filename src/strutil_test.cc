@@ -220,6 +220,33 @@ void TestIsInteger() {
   ASSERT_BOOL(IsInteger("12a4"), false);
 }
 
+void TestRope() {
+  shared_ptr<string> big = make_shared<string>(10000, 'x');
+  Rope r;
+  r.Append("a ");
+  r.Append(big);
+  r.Append(" b");
+  ASSERT_EQ(r.size(), 10004);
+  Rope r2;
+  r2.Append(r);
+  r2.Append(r2);
+  ASSERT_EQ(r2.size(), 20008);
+  // Large pieces are shared, never modified.
+  r.Append("c");
+  ASSERT_EQ(*big, string(10000, 'x'));
+  string s;
+  r2.AppendTo(&s);
+  ASSERT_EQ(s, "a " + *big + " ba " + *big + " b");
+  ASSERT_EQ(*r2.Flatten(), s);
+  ASSERT_EQ(r2.str(), s);
+  assert(r2.Flatten() == r2.Flatten());
+
+  Rope small;
+  small.Append("foo");
+  ASSERT_EQ(small.str(), "foo");
+  ASSERT_EQ(*small.Flatten(), "foo");
+}
+
 }  // namespace
 
 int main() {
@@ -238,5 +265,6 @@ int main() {
   TestFindEndOfLineInvalidAccess();
   TestConcatDir();
   TestIsInteger();
+  TestRope();
   assert(!g_failed);
 }
@@ -30,13 +30,39 @@
 #include "var.h"
 
 struct SymbolData {
-  SymbolData() : gv(Var::Undefined()) {}
+  SymbolData() : gv(Var::Undefined()), version(0), indexed(false) {}
 
   Var* gv;
+  int version;
+  // Whether the symbol is in g_defined_vars.
+  bool indexed;
 };
 
-vector<string*>* g_symbols;
+// An entry of the index behind .VARIABLES and .KATI_SYMBOLS.
+struct DefinedVar {
+  Symbol sym;
+  // The binding |is_func| was computed for.
+  Var* var;
+  int version;
+  bool is_func;
+};
+
+string** g_symbol_chunks[1 << (31 - kSymbolChunkBits)];
 static vector<SymbolData> g_symbol_data;
+// Versions are unique across all symbols, so a version restored by
+// ScopedGlobalVar matches only the binding it was first given to.
+static int g_last_var_version;
+// Symbols which got a defined global variable, in definition order. Entries
+// whose variable has gone away are dropped lazily by GetDefinedVarNames.
+static vector<DefinedVar> g_defined_vars;
+
+static void IndexGlobalVar(Symbol sym) {
+  SymbolData& data = g_symbol_data[sym.val()];
+  if (data.indexed || !data.gv->IsDefined())
+    return;
+  data.indexed = true;
+  g_defined_vars.push_back(DefinedVar{sym, NULL, 0, false});
+}
 
 Symbol kEmptySym;
 Symbol kShellSym;
@@ -94,16 +120,65 @@ void Symbol::SetGlobalVar(Var* v, bool is_override, bool* readonly) const {
   if (orig->IsDefined())
     delete orig;
   g_symbol_data[v_].gv = v;
+  g_symbol_data[v_].version = ++g_last_var_version;
+  IndexGlobalVar(*this);
+}
+
+int Symbol::GlobalVarVersion() const {
+  if (static_cast<size_t>(v_) >= g_symbol_data.size()) {
+    return 0;
+  }
+  return g_symbol_data[v_].version;
+}
+
+void Symbol::BumpGlobalVarVersion() const {
+  if (static_cast<size_t>(v_) >= g_symbol_data.size()) {
+    g_symbol_data.resize(v_ + 1);
+  }
+  g_symbol_data[v_].version = ++g_last_var_version;
+}
+
+int GetLastGlobalVarVersion() {
+  return g_last_var_version;
 }
 
 ScopedGlobalVar::ScopedGlobalVar(Symbol name, Var* var)
     : name_(name), orig_(NULL) {
   orig_ = name.GetGlobalVar();
+  orig_version_ = g_symbol_data[name_.val()].version;
   g_symbol_data[name_.val()].gv = var;
+  g_symbol_data[name_.val()].version = ++g_last_var_version;
+  IndexGlobalVar(name_);
 }
 
 ScopedGlobalVar::~ScopedGlobalVar() {
   g_symbol_data[name_.val()].gv = orig_;
+  g_symbol_data[name_.val()].version = orig_version_;
+  IndexGlobalVar(name_);
+}
+
+void GetDefinedVarNames(Evaluator* ev,
+                        bool include_funcs,
+                        vector<StringPiece>* names) {
+  size_t n = 0;
+  for (size_t i = 0; i < g_defined_vars.size(); i++) {
+    DefinedVar d = g_defined_vars[i];
+    SymbolData& data = g_symbol_data[d.sym.val()];
+    if (!data.gv->IsDefined()) {
+      data.indexed = false;
+      continue;
+    }
+    if (d.var != data.gv || d.version != data.version) {
+      d.var = data.gv;
+      d.version = data.version;
+      d.is_func = d.var->IsFunc(ev);
+    }
+    g_defined_vars[n++] = d;
+    if (d.var->Obsolete() || (!include_funcs && d.is_func))
+      continue;
+    names->push_back(d.sym.str());
+  }
+  g_defined_vars.resize(n);
 }
 
 class Symtab {
@@ -113,8 +188,7 @@ class Symtab {
     tid_ = pthread_self();
 #endif
 
-    CHECK(g_symbols == NULL);
-    g_symbols = &symbols_;
+    CHECK(!g_symbol_chunks[0]);
 
     Symbol s = InternImpl("");
     CHECK(s.v_ == 0);
@@ -140,9 +214,12 @@ class Symtab {
   }
 
   ~Symtab() {
-    LOG_STAT("%zu symbols", symbols_.size());
-    for (string* s : symbols_)
-      delete s;
+    const size_t num_symbols = symtab_.size();
+    LOG_STAT("%zu symbols", num_symbols);
+    for (size_t i = 0; i < num_symbols; i++)
+      delete &Symbol(i).str();
+    for (string** chunk : g_symbol_chunks)
+      delete[] chunk;
   }
 
   Symbol InternImpl(StringPiece s) {
@@ -150,9 +227,14 @@ class Symtab {
     if (found != symtab_.end()) {
       return found->second;
     }
-    symbols_.push_back(new string(s.data(), s.size()));
-    Symbol sym = Symbol(symtab_.size());
-    bool ok = symtab_.emplace(*symbols_.back(), sym).second;
+    const size_t v = symtab_.size();
+    string**& chunk = g_symbol_chunks[v >> kSymbolChunkBits];
+    if (!chunk)
+      chunk = new string*[1 << kSymbolChunkBits];
+    string* str = new string(s.data(), s.size());
+    chunk[v & ((1 << kSymbolChunkBits) - 1)] = str;
+    Symbol sym = Symbol(v);
+    bool ok = symtab_.emplace(*str, sym).second;
     CHECK(ok);
     return sym;
   }
@@ -169,25 +251,8 @@ class Symtab {
     return InternImpl(s);
   }
 
-  vector<StringPiece> GetSymbolNames(std::function<bool(Var*)> const& filter) {
-    vector<StringPiece> result;
-    for (auto entry : symtab_) {
-      Var* var = entry.second.PeekGlobalVar();
-      // The symbol table contains all interned strings, not just variables
-      // which have been defined.
-      if (!var->IsDefined()) {
-        continue;
-      }
-      if (filter(var)) {
-        result.push_back(entry.first);
-      }
-    }
-    return result;
-  }
-
  private:
   unordered_map<StringPiece, Symbol> symtab_;
-  vector<string*> symbols_;
 #ifdef ENABLE_TID_CHECK
   pthread_t tid_;
 #endif
@@ -207,7 +272,3 @@ string JoinSymbols(const vector<Symbol>& syms, const char* sep) {
   }
   return JoinStrings(strs, sep);
 }
-
-vector<StringPiece> GetSymbolNames(std::function<bool(Var*)> const& filter) {
-  return g_symtab.GetSymbolNames(filter);
-}
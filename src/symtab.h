@@ -16,7 +16,6 @@
 #define SYMTAB_H_
 
 #include <bitset>
-#include <functional>
 #include <string>
 #include <vector>
 
@@ -24,8 +23,13 @@
 
 using namespace std;
 
-extern vector<string*>* g_symbols;
+// The strings of the symbols, in chunks of 1 << kSymbolChunkBits which
+// never move once allocated. A thread given a symbol may read its string
+// while another thread interns more.
+const int kSymbolChunkBits = 16;
+extern string** g_symbol_chunks[];
 
+class Evaluator;
 class Symtab;
 class Var;
 
@@ -33,7 +37,10 @@ class Symbol {
  public:
   explicit Symbol() : v_(-1) {}
 
-  const string& str() const { return *((*g_symbols)[v_]); }
+  const string& str() const {
+    return *g_symbol_chunks[v_ >> kSymbolChunkBits]
+                           [v_ & ((1 << kSymbolChunkBits) - 1)];
+  }
 
   const char* c_str() const { return str().c_str(); }
 
@@ -55,6 +62,10 @@ class Symbol {
   void SetGlobalVar(Var* v,
                     bool is_override = false,
                     bool* readonly = nullptr) const;
+  // Changes whenever the global variable is assigned or modified, to a
+  // version newer than any before.
+  int GlobalVarVersion() const;
+  void BumpGlobalVarVersion() const;
 
  private:
   explicit Symbol(int v);
@@ -191,6 +202,9 @@ class SymbolSet {
   std::vector<std::bitset<64> > bits_;
 };
 
+// The newest version given to any global variable.
+int GetLastGlobalVarVersion();
+
 class ScopedGlobalVar {
  public:
   ScopedGlobalVar(Symbol name, Var* var);
@@ -199,6 +213,7 @@ class ScopedGlobalVar {
  private:
   Symbol name_;
   Var* orig_;
+  int orig_version_;
 };
 
 inline bool operator==(const Symbol& x, const Symbol& y) {
@@ -225,7 +240,10 @@ Symbol Intern(StringPiece s);
 
 string JoinSymbols(const vector<Symbol>& syms, const char* sep);
 
-// Get all symbol names for which filter returns true.
-vector<StringPiece> GetSymbolNames(std::function<bool(Var*)> const& filter);
+// Get the names of defined global variables in definition order, skipping
+// obsolete ones, and ones which look like functions unless |include_funcs|.
+void GetDefinedVarNames(Evaluator* ev,
+                        bool include_funcs,
+                        vector<StringPiece>* names);
 
 #endif  // SYMTAB_H_
@@ -16,6 +16,8 @@
 
 #include "var.h"
 
+#include <algorithm>
+
 #include "eval.h"
 #include "expr.h"
 #include "log.h"
@@ -107,11 +109,13 @@ Var* Var::Undefined() {
 SimpleVar::SimpleVar(VarOrigin origin,  std::shared_ptr<Frame> definition, Loc loc)
     : Var(origin, definition, loc) {}
 
-SimpleVar::SimpleVar(const string& v,
+SimpleVar::SimpleVar(StringPiece v,
                      VarOrigin origin,
                       std::shared_ptr<Frame> definition,
                      Loc loc)
-    : Var(origin, definition, loc), v_(v) {}
+    : Var(origin, definition, loc) {
+  v_.Append(v);
+}
 
 SimpleVar::SimpleVar(VarOrigin origin,
                       std::shared_ptr<Frame> definition,
@@ -119,7 +123,7 @@ SimpleVar::SimpleVar(VarOrigin origin,
                      Evaluator* ev,
                      Value* v)
     : Var(origin, definition, loc) {
-  v->Eval(ev, &v_);
+  v->EvalRope(ev, &v_);
 }
 
 bool SimpleVar::IsFunc(Evaluator*) const {
@@ -128,23 +132,33 @@ bool SimpleVar::IsFunc(Evaluator*) const {
 
 void SimpleVar::Eval(Evaluator* ev, string* s) const {
   ev->CheckStack();
-  *s += v_;
+  v_.AppendTo(s);
+}
+
+shared_ptr<string> SimpleVar::EvalShared(Evaluator* ev) const {
+  ev->CheckStack();
+  return v_.Flatten();
+}
+
+void SimpleVar::EvalRope(Evaluator* ev, Rope* r) const {
+  ev->CheckStack();
+  r->Append(v_);
 }
 
 void SimpleVar::AppendVar(Evaluator* ev, Value* v) {
-  string buf;
-  v->Eval(ev, &buf);
-  v_.push_back(' ');
-  v_ += buf;
+  Rope buf;
+  v->EvalRope(ev, &buf);
+  v_.Append(" ");
+  v_.Append(buf);
   definition_ = ev->CurrentFrame();
 }
 
 StringPiece SimpleVar::String() const {
-  return v_;
+  return v_.str();
 }
 
 string SimpleVar::DebugString() const {
-  return v_;
+  return v_.str().as_string();
 }
 
 RecursiveVar::RecursiveVar(Value* v,
@@ -155,18 +169,75 @@ RecursiveVar::RecursiveVar(Value* v,
     : Var(origin, definition, loc), v_(v), orig_(orig) {}
 
 bool RecursiveVar::IsFunc(Evaluator* ev) const {
-  return v_->IsFunc(ev);
+  if (v_->IsFunc(ev))
+    return true;
+  for (Value* v : appended_) {
+    if (v->IsFunc(ev))
+      return true;
+  }
+  return false;
 }
 
 void RecursiveVar::Eval(Evaluator* ev, string* s) const {
   ev->CheckStack();
+  if (!ev->CanMemoizeVars()) {
+    EvalUncached(ev, s);
+    return;
+  }
+
+  if (has_memo_) {
+    bool changed = false;
+    for (auto const& p : memo_reads_.versions) {
+      if (p.first.GlobalVarVersion() != p.second) {
+        changed = true;
+        break;
+      }
+    }
+    if (!changed) {
+      *s += memo_;
+      ev->AddVarReads(memo_reads_);
+      return;
+    }
+    has_memo_ = false;
+  }
+
+  VarReads reads;
+  size_t start = s->size();
+  ev->BeginVarReads(&reads);
+  EvalUncached(ev, s);
+  ev->EndVarReads();
+  if (!reads.memoizable)
+    return;
+  auto& versions = reads.versions;
+  versions.erase(remove_if(versions.begin(), versions.end(),
+                           [&reads](const pair<Symbol, int>& p) {
+                             return p.second > reads.start_version;
+                           }),
+                 versions.end());
+  sort(versions.begin(), versions.end(),
+       [](const pair<Symbol, int>& a, const pair<Symbol, int>& b) {
+         return a.first.val() < b.first.val() ||
+                (a.first == b.first && a.second < b.second);
+       });
+  versions.erase(unique(versions.begin(), versions.end()), versions.end());
+  memo_.assign(*s, start, string::npos);
+  memo_reads_ = move(reads);
+  has_memo_ = true;
+}
+
+void RecursiveVar::EvalUncached(Evaluator* ev, string* s) const {
   v_->Eval(ev, s);
+  for (Value* v : appended_) {
+    *s += ' ';
+    v->Eval(ev, s);
+  }
 }
 
 void RecursiveVar::AppendVar(Evaluator* ev, Value* v) {
   ev->CheckStack();
-  v_ = Value::NewExpr(v->Location(), v_, Value::NewLiteral(" "), v);
+  appended_.push_back(v);
   definition_ = ev->CurrentFrame();
+  has_memo_ = false;
 }
 
 void RecursiveVar::Used(Evaluator* ev, const Symbol& sym) const {
@@ -187,7 +258,14 @@ StringPiece RecursiveVar::String() const {
 }
 
 string RecursiveVar::DebugString() const {
-  return Value::DebugString(v_);
+  // Printed as the ValueLists the appends used to nest into.
+  string r;
+  for (size_t i = 0; i < appended_.size(); i++)
+    r += "ValueList(";
+  r += Value::DebugString(v_);
+  for (Value* v : appended_)
+    r += ",  , " + Value::DebugString(v) + ")";
+  return r;
 }
 
 UndefinedVar::UndefinedVar() {}
@@ -228,17 +306,8 @@ StringPiece VariableNamesVar::String() const {
 
 void VariableNamesVar::ConcatVariableNames(Evaluator* ev, string* s) const {
   WordWriter ww(s);
-  vector<StringPiece>&& symbols = GetSymbolNames([=](Var* var) -> bool {
-    if (var->Obsolete()) {
-      return false;
-    }
-    if (!all_) {
-      if (var->IsFunc(ev)) {
-        return false;
-      }
-    }
-    return true;
-  });
+  vector<StringPiece> symbols;
+  GetDefinedVarNames(ev, all_, &symbols);
   for (auto entry : symbols) {
     ww.Write(entry);
   }
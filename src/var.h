@@ -26,6 +26,7 @@
 #include "log.h"
 #include "stmt.h"
 #include "string_piece.h"
+#include "strutil.h"
 #include "symtab.h"
 
 using namespace std;
@@ -57,6 +58,9 @@ class Var : public Evaluable {
 
   virtual bool IsDefined() const { return true; }
 
+  // Whether the value can change without the variable being assigned.
+  virtual bool IsVolatile() const { return false; }
+
   virtual void AppendVar(Evaluator* ev, Value* v);
 
   virtual StringPiece String() const = 0;
@@ -108,7 +112,7 @@ class Var : public Evaluable {
 class SimpleVar : public Var {
  public:
   explicit SimpleVar(VarOrigin origin,  std::shared_ptr<Frame> definition, Loc loc);
-  SimpleVar(const string& v, VarOrigin origin,  std::shared_ptr<Frame> definition, Loc loc);
+  SimpleVar(StringPiece v, VarOrigin origin,  std::shared_ptr<Frame> definition, Loc loc);
   SimpleVar(VarOrigin origin,
              std::shared_ptr<Frame> definition,
             Loc loc,
@@ -121,13 +125,21 @@ class SimpleVar : public Var {
 
   virtual void Eval(Evaluator* ev, string* s) const override;
 
+  virtual shared_ptr<string> EvalShared(Evaluator* ev) const override;
+
+  virtual void EvalRope(Evaluator* ev, Rope* r) const override;
+
   virtual void AppendVar(Evaluator* ev, Value* v) override;
 
   virtual StringPiece String() const override;
 
   virtual string DebugString() const override;
 
-  string v_;
+ private:
+  // Large pieces are shared with the variables assigned from this one, so
+  // "A := $(B) $(C)" and "A += $(B)" do not copy the lists. Flattened
+  // when a contiguous value is needed.
+  mutable Rope v_;
 };
 
 class RecursiveVar : public Var {
@@ -153,7 +165,18 @@ class RecursiveVar : public Var {
   virtual void Used(Evaluator* ev, const Symbol& sym) const override;
 
   Value* v_;
+  // The values appended by +=, each evaluated after a space. Kept flat so
+  // that a long chain of appends does not nest as deep as it is long.
+  vector<Value*> appended_;
   StringPiece orig_;
+
+ private:
+  void EvalUncached(Evaluator* ev, string* s) const;
+
+  // The last expansion, with --memoize_recursive_vars.
+  mutable bool has_memo_ = false;
+  mutable string memo_;
+  mutable VarReads memo_reads_;
 };
 
 class UndefinedVar : public Var {
@@ -179,6 +202,7 @@ class VariableNamesVar : public Var {
 
   virtual const char* Flavor() const override { return "kati_variable_names"; }
   virtual bool IsDefined() const override { return true; }
+  virtual bool IsVolatile() const override { return true; }
 
   virtual bool IsFunc(Evaluator* ev) const override;
 
@@ -0,0 +1,74 @@
+#!/bin/bash
+# TODO(ninja): ninja runs the recipes with its own -j and no jobserver
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+mk="$@"
+
+# Each job of a pair waits for the other one to start, so the pair only
+# finishes in time if both jobs run at once.
+cat <<'EOF2' > rules.mk
+define wait_for
+@touch $@.started; \
+for i in $$(seq 50); do test -e $(1).started && break; sleep 0.1; done; \
+if test -e $(1).started; then echo $@: parallel; else echo $@: alone; fi > $@
+endef
+EOF2
+
+cat <<'EOF2' > Makefile
+include rules.mk
+all: top sub
+top: a b
+	@cat a b
+a:
+	$(call wait_for,b)
+b:
+	$(call wait_for,a)
+# The sub-make has no -j of its own and shares our job slots.
+sub: top
+	+@$(MAKE) -s -f sub.mk
+EOF2
+
+cat <<'EOF2' > sub.mk
+include rules.mk
+sub: c d
+	@cat c d
+c:
+	$(call wait_for,d)
+d:
+	$(call wait_for,c)
+EOF2
+
+cat <<'EOF2' > fail.mk
+all: after
+after: bad
+	@echo FAIL
+bad:
+	@exit 1
+EOF2
+
+${mk} -j2
+rm -f *.started a b c d
+
+# With a single job, nothing runs in parallel.
+${mk} -j1
+rm -f *.started a b c d
+
+# A failed job stops the jobs which depend on it.
+if ${mk} -j2 -f fail.mk 2> /dev/null; then
+  echo "fail.mk succeeded"
+fi
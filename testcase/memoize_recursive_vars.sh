@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+mk="$@"
+
+cat <<'EOF2' > Makefile
+X = x1
+Y = $(X) y
+Z = <$(Y)>
+$(info $(Z))
+X = x2
+$(info $(Z))
+X += x3
+$(info $(Z))
+
+# Variables whose names are computed.
+N = a
+a_val = A
+b_val = B
+V = $($(N)_val)
+$(info $(V))
+N = b
+$(info $(V))
+b_val = B2
+$(info $(V))
+
+# Variables read through foreach and call bindings.
+F = [$(i)]
+$(info $(foreach i,1 2 3,$(F)))
+$(info $(foreach i,4 5,$(F)))
+G = ($(1)$(2))
+$(info $(call G,p,q) $(call G,r))
+H = $(foreach i,7 8,$(call G,$(i),$(F)))
+$(info $(H))
+i = 9
+$(info $(F) $(H))
+
+# Variables changed by eval, define and override.
+$(eval X = x4)
+$(info $(Z))
+define X
+x5
+endef
+$(info $(Z))
+override X = x6
+$(info $(Z))
+
+# Impure functions are evaluated every time.
+S = $(shell cat count.tmp 2>/dev/null)
+$(info $(S))
+$(file >count.tmp,1)
+$(info $(S))
+
+# Target-specific and automatic variables.
+T = $(X) $@
+all: foo bar
+	@echo '$(T) $(Z)'
+foo: X = x7
+foo:
+	@echo '$(T) $(Z)'
+bar:
+	@echo '$(T) $(Z)'
+EOF2
+
+if echo "${mk}" | grep -q "kati"; then
+  ${mk} --memoize_recursive_vars
+else
+  ${mk}
+fi
@@ -0,0 +1,65 @@
+#!/bin/bash
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http:#www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+log=/tmp/log
+mk="$@"
+reader="$(cd "$(dirname "$0")" && pwd)/tools/binary_ninja.py"
+
+cat <<EOF2 > Makefile
+all: c
+a:
+	@echo a
+b: | a
+	@echo b \$\$HOME | sed 's/ .*//'
+c: a b
+	@echo \$@ from \$^
+EOF2
+
+${mk} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+fi
+
+if echo "${mk}" | grep -q "kati"; then
+  # Stock ninja cannot read the binary format.
+  if ${mk} --ninja_format=binary 2> ${log}; then
+    echo "--ninja_format=binary was accepted without a reader"
+  fi
+fi
+
+# The binary manifest must build the same as the text one.
+args=
+if echo "${mk}" | grep -q "kati"; then
+  args="--ninja_format=binary --ninja_reader=${reader}"
+fi
+${mk} ${args} 2> ${log}
+if [ -e ninja.sh ]; then
+  if ! grep -q "kati-ninja" build.ninja; then
+    echo "build.ninja is not binary"
+  fi
+  ./ninja.sh
+fi
+
+# Also with subninja files.
+if echo "${mk}" | grep -q "kati"; then
+  args="${args} --ninja_shards=2"
+fi
+${mk} ${args} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+fi
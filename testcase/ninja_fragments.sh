@@ -0,0 +1,93 @@
+#!/bin/bash
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http:#www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+log=/tmp/log
+mk="$@"
+
+cat <<EOF2 > Makefile
+include a.mk b.mk
+EOF2
+cat <<EOF2 > a.mk
+all: a
+a:
+	@echo a
+EOF2
+cat <<EOF2 > b.mk
+all: b
+b: a
+	@echo b
+c.o:
+	prebuilts/clang/linux-x86/host/3.6/bin/clang++ -c c.c
+EOF2
+
+${mk} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  cp build.ninja build.ninja.unfragmented
+fi
+
+# The fragments must build the same as a single build.ninja.
+args=
+if echo "${mk}" | grep -q "kati"; then
+  args="--ninja_fragments --kati_stats"
+fi
+${mk} ${args} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  if ! grep -q "0/2 ninja fragments reused" ${log}; then
+    echo "Unexpected fragments"
+  fi
+fi
+
+# Only the fragment of the edited makefile is written again.
+sed -i 's/echo b/echo b2/' b.mk
+${mk} ${args} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  if ! grep -q "1/2 ninja fragments reused" ${log}; then
+    echo "The fragment of a.mk was not reused"
+  fi
+fi
+
+# Files in place of the fragments are not reused unless kati wrote them
+# for the same digest.
+if [ -e ninja.sh ]; then
+  for f in kati_fragments/*.ninja; do
+    echo "# Not a fragment" > ${f}
+  done
+  # Make --regen run again.
+  touch Makefile
+  ${mk} ${args} 2> ${log}
+  if ! grep -q "0/2 ninja fragments reused" ${log}; then
+    echo "A file which is not a fragment was reused"
+  fi
+fi
+
+# Fragments depend on the gomacc path.
+if [ -e ninja.sh ]; then
+  ${mk} ${args} --goma_dir=/goma1 c.o 2> ${log}
+  ${mk} ${args} --goma_dir=/goma2 c.o 2> ${log}
+  if ! grep -q "/goma2/gomacc" kati_fragments/*; then
+    echo "The fragment of b.mk still uses the old gomacc"
+  fi
+fi
+
+${mk} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+fi
@@ -0,0 +1,92 @@
+#!/bin/bash
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http:#www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+log=/tmp/log
+mk="$@"
+
+cat <<EOF2 > Makefile
+all: d
+a:
+	@echo a
+b: a
+	@echo b
+c: b
+	@echo c
+d: c
+	@echo d
+EOF2
+
+${mk} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  cp build.ninja build.ninja.unsharded
+fi
+
+# The shards must build the same as a single build.ninja.
+args=
+if echo "${mk}" | grep -q "kati"; then
+  args=--ninja_shards=3
+fi
+${mk} ${args} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  for i in 0 1 2; do
+    if [ ! -e build.${i}.ninja ]; then
+      echo "build.${i}.ninja is missing"
+    fi
+  done
+fi
+
+# More shards than CPUs are written by a bounded number of threads.
+if echo "${mk}" | grep -q "kati"; then
+  args=--ninja_shards=64
+fi
+${mk} ${args} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  if [ ! -e build.63.ninja ]; then
+    echo "build.63.ninja is missing"
+  fi
+fi
+
+# Shards which are no longer used must be removed.
+if echo "${mk}" | grep -q "kati"; then
+  args=--ninja_shards=2
+fi
+${mk} ${args} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  if [ -e build.2.ninja ] || [ -e build.63.ninja ]; then
+    echo "build.2.ninja was not removed"
+  fi
+  if [ -e .build.2.ninja.kati_hash ]; then
+    echo ".build.2.ninja.kati_hash was not removed"
+  fi
+fi
+
+${mk} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  if ls build.*.ninja > /dev/null 2>&1 ||
+     ls .build.*.ninja.kati_hash > /dev/null 2>&1; then
+    echo "shards were not removed"
+  fi
+  if ! cmp -s build.ninja build.ninja.unsharded; then
+    echo "build.ninja differs after sharding"
+  fi
+fi
@@ -0,0 +1,66 @@
+#!/bin/bash
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http:#www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+log=/tmp/log
+mk="$@"
+
+# More nodes than fit in one batch of the streaming emitter.
+cat <<EOF2 > Makefile
+N := \$(shell seq 1 3000)
+all: \$(addprefix t,\$(N)) cmd
+	@echo done
+\$(addprefix t,\$(N)):
+cmd: t1
+	@echo \$@ from \$<
+EOF2
+
+${mk} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  cp build.ninja build.ninja.unstreamed
+fi
+
+# Streaming must write the same build.ninja.
+args=
+if echo "${mk}" | grep -q "kati"; then
+  args=--ninja_streaming
+fi
+${mk} ${args} 2> ${log}
+if [ -e ninja.sh ]; then
+  ./ninja.sh
+  if ! cmp -s build.ninja build.ninja.unstreamed; then
+    echo "build.ninja differs when streamed"
+  fi
+fi
+
+# A streamed build.ninja is left as it was if generating it fails, here
+# because the depfile of a command cannot be found, and its temporary file
+# is removed.
+if [ -e ninja.sh ]; then
+  cp build.ninja build.ninja.good
+  printf 'all: bad\nbad:\n\tgcc -MD -c bad.c\n' >> Makefile
+  if ${mk} ${args} --detect_depfiles 2> ${log}; then
+    echo "kati did not fail"
+  fi
+  if ! cmp -s build.ninja build.ninja.good; then
+    echo "build.ninja was replaced"
+  fi
+  if [ -e build.ninja.tmp ]; then
+    echo "build.ninja.tmp was left behind"
+  fi
+fi
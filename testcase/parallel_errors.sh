@@ -0,0 +1,33 @@
+#!/bin/bash
+# TODO(ninja): ninja runs the recipes with -j1
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+mk="$@"
+
+# Both failures are reported, the second one while waiting for it.
+cat <<'EOF2' > Makefile
+all: a b
+a:
+	@sleep 0.2; echo a; exit 1
+b:
+	@sleep 0.6; echo b; exit 2
+EOF2
+
+if ${mk} -j2 2>&1; then
+  echo "Succeeded unexpectedly"
+fi
@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http:#www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+mk="$@"
+
+cat <<EOF2 > Makefile
+A := \$(shell cat input)
+B := \$(shell date +%s%N)
+C := \$(shell awk 'BEGIN { srand(); print rand() }')
+\$(info \$(A))
+\$(file >date.txt,\$(B))
+\$(file >rand.txt,\$(C))
+all:
+	@:
+EOF2
+
+args=
+if echo "${mk}" | grep -q "kati"; then
+  args="--shell_cache=$(pwd)/shell_cache"
+fi
+
+echo v1 > input
+# Inputs modified just before a command runs are not trusted.
+touch -t 197101010000 input
+${mk} ${args}
+cp date.txt date1.txt
+cp rand.txt rand1.txt
+# awk seeds its random numbers with the time in seconds.
+sleep 1
+${mk} ${args}
+# Commands which print the time or random numbers must not be cached.
+if cmp -s date.txt date1.txt; then
+  echo "The output of date was cached"
+fi
+if cmp -s rand.txt rand1.txt; then
+  echo "The output of awk was cached"
+fi
+
+# A cached result is not used once the files it read change.
+echo v2 > input
+${mk} ${args}
+
+# The same command run from another directory is not the same command.
+mkdir a b
+cat <<'EOF2' > a/Makefile
+$(info $(notdir $(shell pwd)))
+all:
+	@:
+EOF2
+cp a/Makefile b/Makefile
+touch -t 197101010000 a b a/Makefile b/Makefile
+${mk} -s -C a ${args}
+${mk} -s -C b ${args}
@@ -0,0 +1,14 @@
+A := a b
+B := $(A)
+C := $(B)
+B += c
+A += d
+C := $(C) e
+D := $(A)
+D += $(D)
+
+test:
+	echo A=$(A)
+	echo B=$(B)
+	echo C=$(C)
+	echo D=$(D)
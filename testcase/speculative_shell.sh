@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http:#www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+mk="$@"
+
+cat <<EOF2 > Makefile
+A := \$(shell sleep 0.2; echo a; echo a-err >&2)
+B := \$(shell echo b; echo b-err >&2)
+C := \$(shell echo c-err >&2; echo c)
+D = \$(shell echo d)
+E := \$(shell echo e) \$(D)
+F := \$(shell mkdir -p d && echo f > d/f)
+G := \$(shell ls d)
+\$(info \$(A) \$(B) \$(C) \$(E) \$(G))
+all:
+	@echo done
+EOF2
+
+# Speculated commands must print their stderr in order and give the same
+# results as running them one by one. Commands after one which writes files
+# must see what it wrote.
+args=
+if echo "${mk}" | grep -q "kati"; then
+  args="--speculative_shell -j4"
+fi
+${mk} ${args} 2>&1
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+#
+# Runs ninja on a manifest written with --ninja_format=binary, by
+# translating it and the subninja files it refers to into text first.
+# Usage: binary_ninja.py -f build.ninja [ninja args...]
+#
+
+import os
+import struct
+import sys
+
+FORMAT_VERSION = 2
+
+STRING, VARIABLE, POOL, RULE, BUILD, SUBNINJA, DEFAULT = range(1, 8)
+
+
+class Reader(object):
+  def __init__(self, data):
+    self.data = data
+    self.pos = 0
+
+  def done(self):
+    return self.pos == len(self.data)
+
+  def int(self):
+    v, = struct.unpack_from("<I", self.data, self.pos)
+    self.pos += 4
+    return v
+
+  def string(self):
+    n = self.int()
+    s = self.data[self.pos:self.pos + n].decode("utf-8", "surrogateescape")
+    self.pos += n
+    return s
+
+
+def escape(path):
+  for c in "$: ":
+    path = path.replace(c, "$" + c)
+  return path
+
+
+def text_filename(filename):
+  return filename + ".text"
+
+
+def translate(filename):
+  with open(filename, "rb") as f:
+    r = Reader(f.read())
+  if r.string() != "kati-ninja" or r.int() != FORMAT_VERSION:
+    sys.exit("%s: not a binary ninja manifest of version %d" %
+             (filename, FORMAT_VERSION))
+  r.string()
+
+  strings = []
+  out = []
+
+  def bindings():
+    return ["  %s = %s" % (r.string(), r.string()) for _ in range(r.int())]
+
+  while not r.done():
+    kind = r.int()
+    if kind == STRING:
+      strings.append(r.string())
+    elif kind == VARIABLE:
+      out.append("%s = %s" % (r.string(), r.string()))
+    elif kind == POOL:
+      out.append("pool %s\n  depth = %d" % (strings[r.int()], r.int()))
+    elif kind == RULE:
+      out.append("\n".join(["rule " + strings[r.int()]] + bindings()))
+    elif kind == BUILD:
+      rule = strings[r.int()]
+      counts = [r.int() for _ in range(6)]
+      paths = [[escape(strings[r.int()]) for _ in range(n)] for n in counts]
+      outputs, implicit_outputs, inputs, order_onlys, validations, symlinks = (
+          paths)
+      line = "build " + " ".join(outputs)
+      if implicit_outputs:
+        line += " | " + " ".join(implicit_outputs)
+      line += ": " + " ".join([rule] + inputs)
+      if order_onlys:
+        line += " || " + " ".join(order_onlys)
+      if validations:
+        line += " |@ " + " ".join(validations)
+      lines = [line]
+      if symlinks:
+        lines.append("  symlink_outputs = " + " ".join(symlinks))
+      out.append("\n".join(lines + bindings()))
+    elif kind == SUBNINJA:
+      sub = strings[r.int()]
+      translate(sub)
+      out.append("subninja " + escape(text_filename(sub)))
+    elif kind == DEFAULT:
+      out.append("default " +
+                 " ".join(escape(strings[r.int()]) for _ in range(r.int())))
+    else:
+      sys.exit("%s: unknown record %d" % (filename, kind))
+
+  with open(text_filename(filename), "w") as f:
+    f.write("\n".join(out) + "\n")
+
+
+def main():
+  args = sys.argv[1:]
+  if len(args) < 2 or args[0] != "-f":
+    sys.exit("Usage: %s -f build.ninja [ninja args...]" % sys.argv[0])
+  translate(args[1])
+  args[1] = text_filename(args[1])
+  os.execvp("ninja", ["ninja"] + args)
+
+
+if __name__ == "__main__":
+  main()
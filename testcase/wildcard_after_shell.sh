@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# Copyright 2026 Google Inc. All rights reserved
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http:#www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+set -e
+
+mk="$@"
+
+mkdir -p dir
+touch dir/old.c
+cat <<EOF2 > Makefile
+\$(info \$(wildcard dir/*.c))
+\$(info \$(wildcard new*))
+\$(shell touch dir/new.c newfile)
+\$(info \$(wildcard dir/*c))
+\$(info \$(wildcard ne*))
+\$(file >newfile2,)
+\$(info \$(wildcard newfile?))
+all:
+	@:
+EOF2
+# Globs are cached by pattern, so each is only used once. Old timestamps
+# let the find emulator trust the directories it read.
+touch -t 197101010000 . dir
+
+if echo "${mk}" | grep -qv "kati"; then
+  # Make caches the directories it read, so write the expected output.
+  echo 'dir/old.c'
+  echo ''
+  echo 'dir/new.c dir/old.c'
+  echo 'newfile'
+  echo 'newfile2'
+else
+  # Ninja mode reports the regeneration on stderr.
+  ${mk} --use_find_emulator 2>/dev/null
+fi